@@ -6,80 +6,325 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <atomic>
-#include <codecvt>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
 #include <condition_variable>
+#include <csignal>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <cwchar>
 #include <ctime>
-#include <deque>
+#include <exception>
 #include <fstream>
+#include <future>
 #include <iostream>
-#include <locale>
+#include <limits>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
 #include <thread>
 #include <time.h>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#else
+#include <process.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/**
+ * Build the FileSinkMode::IoUring backend, Linux only. build.py defines this when <linux/io_uring.h> is available.
+ */
+#ifndef SINGLELOG_IO_URING
+#define SINGLELOG_IO_URING 0
+#endif
+
+#if SINGLELOG_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+/**
+ * The LOGFMT_* macros need std::format, available in C++20 from standard libraries that provide <format>
+ */
+#if defined(__has_include)
+#if __has_include(<version>)
+#include <version>
+#endif
+#endif
+
+#if defined(__cpp_lib_string_view)
+#include <string_view>
+#endif
+
+#if defined(__cpp_lib_format) && !defined(SINGLELOG_HAS_STD_FORMAT)
+#define SINGLELOG_HAS_STD_FORMAT 1
+#endif
+
+#ifndef SINGLELOG_HAS_STD_FORMAT
+#define SINGLELOG_HAS_STD_FORMAT 0
+#endif
+
+#if SINGLELOG_HAS_STD_FORMAT
+#include <format>
+#include <iterator>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#if defined(SINGLELOG_USE_RDTSC) && (defined(__x86_64__) || defined(_M_X64))
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+/**
+ * Size the writer queues are allocated at, and so the largest capacity SetConsoleQueueCapacity() and
+ * SetFileQueueCapacity() accept
+ */
+#ifndef SINGLELOG_MAX_QUEUE_CAPACITY
+#define SINGLELOG_MAX_QUEUE_CAPACITY 8192
+#endif
 
 namespace Uplinkzero
 {
 
 namespace
 {
-    // C++11 format converter
-    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> utfConverter;
-    std::mutex utfConverterLock;
-
-    std::string ToNarrow(const std::wstring& inString)
+    /**
+     * Append wide text to out as UTF-8. wchar_t holds UTF-16 where it is 16 bits (Windows) and UTF-32 elsewhere.
+     * Unpaired surrogates and values above U+10FFFF are written as U+FFFD rather than failing the whole string.
+     * Stateless, so it needs no lock. With SSE2, runs of ASCII are narrowed 16 characters at a time.
+     */
+    template <typename String>
+    void AppendUtf8(const wchar_t* text, std::size_t length, String& out)
     {
-        std::lock_guard<std::mutex> lock(utfConverterLock);
-        return utfConverter.to_bytes(inString);
+        auto start = out.size();
+        out.resize(start + length * (WCHAR_MAX > 0xFFFF ? 4 : 3));
+        char* dst = &out[start];
+        std::size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+#if WCHAR_MAX > 0xFFFF
+        const __m128i nonAscii = _mm_set1_epi32(~0x7F);
+#else
+        const __m128i nonAscii = _mm_set1_epi16(~0x7F);
+#endif
+#endif
+        while (i < length)
+        {
+#if defined(__SSE2__) || defined(_M_X64)
+            while (i + 16 <= length)
+            {
+                auto block = reinterpret_cast<const __m128i*>(text + i);
+#if WCHAR_MAX > 0xFFFF
+                __m128i a = _mm_loadu_si128(block);
+                __m128i b = _mm_loadu_si128(block + 1);
+                __m128i c = _mm_loadu_si128(block + 2);
+                __m128i d = _mm_loadu_si128(block + 3);
+                __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+#else
+                __m128i a = _mm_loadu_si128(block);
+                __m128i b = _mm_loadu_si128(block + 1);
+                __m128i any = _mm_or_si128(a, b);
+#endif
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(any, nonAscii), _mm_setzero_si128())) != 0xFFFF)
+                {
+                    break;
+                }
+#if WCHAR_MAX > 0xFFFF
+                __m128i narrow = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+#else
+                __m128i narrow = _mm_packus_epi16(a, b);
+#endif
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), narrow);
+                i += 16;
+                dst += 16;
+            }
+            if (i == length)
+            {
+                break;
+            }
+#endif
+            auto unit = static_cast<std::uint32_t>(text[i++]);
+            if (unit < 0x80)
+            {
+                *dst++ = static_cast<char>(unit);
+                continue;
+            }
+            auto codePoint = unit;
+            if (unit >= 0xD800 && unit <= 0xDFFF)
+            {
+                codePoint = 0xFFFD;
+#if WCHAR_MAX <= 0xFFFF
+                if (unit <= 0xDBFF && i < length && text[i] >= 0xDC00 && text[i] <= 0xDFFF)
+                {
+                    codePoint = 0x10000 + ((unit - 0xD800) << 10) + (static_cast<std::uint32_t>(text[i++]) - 0xDC00);
+                }
+#endif
+            }
+            else if (unit > 0x10FFFF)
+            {
+                codePoint = 0xFFFD;
+            }
+
+            if (codePoint < 0x800)
+            {
+                *dst++ = static_cast<char>(0xC0 | (codePoint >> 6));
+            }
+            else if (codePoint < 0x10000)
+            {
+                *dst++ = static_cast<char>(0xE0 | (codePoint >> 12));
+                *dst++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            }
+            else
+            {
+                *dst++ = static_cast<char>(0xF0 | (codePoint >> 18));
+                *dst++ = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+                *dst++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            }
+            *dst++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        out.resize(static_cast<std::size_t>(dst - &out[0]));
     }
 
-    std::wstring ToWide(const std::string& inString)
+    std::string ToNarrow(const std::wstring& inString)
     {
-        std::lock_guard<std::mutex> lock(utfConverterLock);
-        return utfConverter.from_bytes(inString);
+        std::string narrow;
+        AppendUtf8(inString.data(), inString.size(), narrow);
+        return narrow;
     }
 
     /**
-     * Get current date/time, format is YYYY-MM-DD HH:mm:ss
-     * ref: http://en.cppreference.com/w/cpp/chrono/c/wcsftime
+     * Match text against a pattern where * stands for any run of characters and ? for any one character
      */
-    std::string CurrentDateTime()
+    bool GlobMatch(const char* pattern, const char* text)
     {
-        auto now = std::chrono::system_clock::now();
-        std::time_t ttnow = std::chrono::system_clock::to_time_t(now);
-        char timedisplay[64];
-        tm buf;
-#ifdef WIN32
-        localtime_s(&buf, &ttnow);
-#else
-        localtime_r(&ttnow, &buf);
-#endif
-        if (std::strftime(timedisplay, sizeof(timedisplay), "%F %T %z", &buf))
+        const char* star = nullptr;
+        const char* resume = nullptr;
+        while (*text != '\0')
+        {
+            if (*pattern == '*')
+            {
+                star = pattern++;
+                resume = text;
+            }
+            else if (*pattern != '\0' && (*pattern == '?' || *pattern == *text))
+            {
+                ++pattern;
+                ++text;
+            }
+            else if (star != nullptr)
+            {
+                // Let the last * take one more character and try again from there
+                pattern = star + 1;
+                text = ++resume;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        while (*pattern == '*')
         {
-            return timedisplay;
+            ++pattern;
         }
-        return "";
+        return *pattern == '\0';
     }
+} // namespace
 
+namespace StringTools
+{
     /**
-     * Get current date/time, format is YYYY-MM-DD HH:mm:ss
-     * ref: http://en.cppreference.com/w/cpp/chrono/c/wcsftime
+     * Follows the unformatted format when snprintf fails, e.g. on a wide string the locale cannot convert
      */
-    std::wstring CurrentDateTimeW()
+    constexpr char FormatErrorMarker[] = " [format error]";
+
+    template <typename... Args>
+    std::string string_format(const std::string& format, Args&&... args)
     {
-        return ToWide(CurrentDateTime());
+        auto size = std::snprintf(nullptr, 0, format.c_str(), std::forward<Args>(args)...) + 1; // Extra space for '\0'
+        if (size <= 0)
+        {
+            return format + FormatErrorMarker;
+        }
+        std::unique_ptr<char[]> buffer = std::make_unique<char[]>(static_cast<size_t>(size));
+        std::snprintf(buffer.get(), static_cast<size_t>(size), format.c_str(), std::forward<Args>(args)...);
+        return std::string(buffer.get(), buffer.get() + size - 1); // We don't want the '\0' inside
     }
-} // namespace
+} // namespace StringTools
 
 namespace Logging
 {
     constexpr auto LogggerInternalBufferSize = 10240;
+    constexpr std::size_t LoggerQueueCapacity = SINGLELOG_MAX_QUEUE_CAPACITY;
+    constexpr std::size_t LoggerThreadQueueCapacity = 1024;
+    constexpr std::size_t CacheLineSize = 64;
+    constexpr std::size_t LoggerDeferredArgsCapacity = 128;
+    constexpr std::size_t LoggerWriteBatchSize = 65536;
+    constexpr std::size_t LoggerMappedSegmentSize = 4 * 1024 * 1024;
+    constexpr std::chrono::seconds LoggerDropReportInterval{1};
+    constexpr std::size_t LoggerMaxSinks = 8;
+    constexpr std::size_t LoggerTraceBufferCapacity = 16384;
+    constexpr std::chrono::milliseconds LoggerTraceFlushInterval{50};
+    constexpr std::size_t LoggerModuleCacheSize = 256;
+    constexpr std::size_t LoggerFlightRecorderCapacity = 256;
+    constexpr std::size_t LoggerFlightRecorderSlotSize = 512;
+    constexpr std::chrono::seconds LoggerCrashFlushTimeout{2};
+    constexpr std::chrono::milliseconds LoggerCrashWakeInterval{50};
+    constexpr std::size_t LoggerUringBufferCount = 8;
+    constexpr std::size_t LoggerUringBufferSize = 256 * 1024;
+    constexpr std::chrono::seconds LoggerUringSyncInterval{1};
+    constexpr std::uint32_t LoggerWriterSpinCount = 2000;
+    constexpr std::chrono::milliseconds LoggerWriterPollInterval{1};
+    constexpr std::size_t LoggerPoolSizeClasses = 4;
+    constexpr std::size_t LoggerPoolSmallestBlock = 64;
+
+    /**
+     * Ring buffer capacities are rounded up so indices can be masked rather than divided
+     */
+    inline std::size_t RoundUpPowerOfTwo(std::size_t n)
+    {
+        std::size_t result = 2;
+        while (result < n)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    /**
+     * Tell the CPU the caller is spinning, so it backs off while the other side makes progress
+     */
+    inline void CpuRelax()
+    {
+#if defined(__SSE2__) || defined(_M_X64)
+        _mm_pause();
+#endif
+    }
 
     /**
      * Levels of logging available
@@ -97,451 +342,6084 @@ namespace Logging
     };
 
     /**
-     * Logger class
+     * How producers hand messages to the writer threads
+     * Shared: all threads push to one lock-free queue per writer
+     * PerThread: every thread lazily gets its own buffer per writer, so producers share no state at all
      */
-    class SingleLog final
+    enum class QueueMode
     {
-    private:
+        Shared,
+        PerThread
+    };
+
+    /**
+     * What a logging thread does when the queue to a writer is full
+     * Block: wait for the writer to make room
+     * DropNewest: discard the message being logged
+     * DropOldest: discard the oldest queued message to make room. Thread buffers in QueueMode::PerThread can only be
+     *             emptied by their writer, so there a full buffer discards the message being logged instead.
+     * DropBelowLevel: discard messages below L_WARNING, wait for room for the rest
+     */
+    enum class OverflowPolicy
+    {
+        Block,
+        DropNewest,
+        DropOldest,
+        DropBelowLevel
+    };
+
+    /**
+     * How a writer thread waits for messages once its queue is empty
+     * Park: sleep until woken. Producers only make the wakeup call when the writer is parked, so a busy writer
+     *       costs them nothing.
+     * SpinThenPark: keep checking the queue for a spin budget before parking, so a message that arrives soon is
+     *               picked up without a wakeup, at the price of CPU time on the writer's core
+     * Poll: never park, check the queue at a fixed interval. Producers never make a wakeup call, and messages wait
+     *       up to one interval.
+     */
+    enum class WakeupPolicy
+    {
+        Park,
+        SpinThenPark,
+        Poll
+    };
+
+    /**
+     * Which threads write the outputs
+     * PerOutput: the console, the file and each sink have their own writer thread, so a slow output cannot hold up
+     *            the others
+     * Shared: one writer thread serves every output, for processes where thread count matters more
+     */
+    enum class WriterThreads
+    {
+        PerOutput,
+        Shared
+    };
+
+    /**
+     * Level names as they appear in the log line
+     */
+    inline const char* LevelName(LogLevel level)
+    {
+        switch (level)
+        {
+        case LogLevel::L_TRACE:
+            return "TRACE";
+        case LogLevel::L_DEBUG:
+            return "DEBUG";
+        case LogLevel::L_INFO:
+            return "INFO";
+        case LogLevel::L_NOTICE:
+            return "NOTICE";
+        case LogLevel::L_WARNING:
+            return "WARNING";
+        case LogLevel::L_ERROR:
+            return "ERROR";
+        case LogLevel::L_CRITICAL:
+            return "CRITICAL";
+        case LogLevel::L_OFF:
+            return "OFF";
+        default:
+            return "";
+        }
+    }
+
+    /**
+     * How the log file is written
+     * Stream: a buffered std::ofstream
+     * MemoryMapped: preallocated segments of the file are mapped into memory and messages are copied straight in.
+     *               Falls back to Stream where mapping is unavailable.
+     * IoUring: writes and a periodic fdatasync are submitted through io_uring with several buffers in flight, so
+     *          the writer does not wait for the disk. Needs SINGLELOG_IO_URING, falls back to Stream without it
+     *          or where the kernel refuses io_uring or cannot write through it. After a failed write the file is
+     *          written synchronously, counted in SinkStats::writeErrors.
+     */
+    enum class FileSinkMode
+    {
+        Stream,
+        MemoryMapped,
+        IoUring
+    };
+
+    /**
+     * Layout of the messages written to the log file
+     * Text: the human readable "<time>  <LEVEL>  module:  message" lines
+     * Binary: compact records decoded offline by singlelog-decode, see BinaryFormat
+     * Json: one JSON object per line with time, level, thread, module, message and any key-value fields
+     * Logfmt: one line of key=value pairs per message, the same keys as Json with msg for the message
+     */
+    enum class OutputFormat
+    {
+        Text,
+        Binary,
+        Json,
+        Logfmt
+    };
+
+    /**
+     * Precision of the fractional seconds written after the time, Seconds writes none
+     */
+    enum class TimestampPrecision
+    {
+        Seconds,
+        Milliseconds,
+        Microseconds,
+        Nanoseconds
+    };
+
+    /**
+     * Timestamps are taken as raw ticks on the logging thread and only converted to wall time by the writers.
+     * The raw clock is steady_clock, or the CPU timestamp counter when SINGLELOG_USE_RDTSC is defined on x86-64.
+     */
+    class Clock final
+    {
+    public:
+        static std::uint64_t Now()
+        {
+#if defined(SINGLELOG_USE_RDTSC) && (defined(__x86_64__) || defined(_M_X64))
+            return __rdtsc();
+#else
+            return static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count());
+#endif
+        }
+
         /**
-         * Private Constructor
+         * Pin a raw tick value to wall time. Cheap enough for the writers to redo every second, which keeps
+         * converted times following any adjustment of the system clock.
          */
-        SingleLog()
-            : m_consoleLogLevel(LogLevel::L_TRACE), m_fileLogLevel(LogLevel::L_TRACE), m_filePath("")
+        void Calibrate()
         {
-            m_consoleWriter = std::thread(&SingleLog::ConsoleWriter, this);
-            m_fstreamWriter = std::thread(&SingleLog::FstreamWriter, this);
+            auto wall = WallNanos();
+            auto raw = Now();
+#if defined(SINGLELOG_USE_RDTSC) && (defined(__x86_64__) || defined(_M_X64))
+            auto steady = SteadyNanos();
+            if (m_firstRaw == 0)
+            {
+                // Measure the counter against steady_clock for a millisecond to get a first rate
+                m_firstRaw = raw;
+                m_firstSteady = steady;
+                while (SteadyNanos() - m_firstSteady < 1000000)
+                {
+                }
+                wall = WallNanos();
+                raw = Now();
+                steady = SteadyNanos();
+            }
+            m_nanosPerTick = static_cast<double>(steady - m_firstSteady) / static_cast<double>(raw - m_firstRaw);
+#endif
+            m_anchorWall = wall;
+            m_anchorRaw = raw;
         }
 
         /**
-         * Delete copy constructor
+         * Wall clock nanoseconds since the epoch for a Now() value
          */
-        SingleLog(SingleLog const& copy) = delete;
-        SingleLog& operator=(SingleLog const& copy) = delete;
+        std::int64_t ToWallNanos(std::uint64_t raw) const
+        {
+            auto ticks = static_cast<std::int64_t>(raw - m_anchorRaw);
+#if defined(SINGLELOG_USE_RDTSC) && (defined(__x86_64__) || defined(_M_X64))
+            return m_anchorWall + static_cast<std::int64_t>(static_cast<double>(ticks) * m_nanosPerTick);
+#else
+            return m_anchorWall + ticks;
+#endif
+        }
+
+    private:
+        static std::int64_t WallNanos()
+        {
+            return static_cast<std::int64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                    .count());
+        }
+
+        static std::int64_t SteadyNanos()
+        {
+            return static_cast<std::int64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count());
+        }
 
+        std::int64_t m_anchorWall{0};
+        std::uint64_t m_anchorRaw{0};
+#if defined(SINGLELOG_USE_RDTSC) && (defined(__x86_64__) || defined(_M_X64))
+        std::uint64_t m_firstRaw{0};
+        std::int64_t m_firstSteady{0};
+        double m_nanosPerTick{1.0};
+#endif
+    };
+
+    /**
+     * Renders raw timestamps as "YYYY-MM-DD HH:MM:SS[.fraction] +zzzz".
+     * localtime and strftime only run when the second changes, every other call reuses the cached text.
+     * ref: http://en.cppreference.com/w/cpp/chrono/c/strftime
+     */
+    class TimestampFormatter final
+    {
     public:
-        /**
-         * Return a reference to the instance of this class
-         * C++11 handles thread safety and removes the need for manual locking
-         * http://stackoverflow.com/questions/8102125/is-local-static-variable-initialization-thread-safe-in-c11
-         * http://stackoverflow.com/questions/33114896/reentrancy-in-static-method-with-static-variable
-         */
-        static SingleLog& GetInstance()
+        TimestampFormatter()
         {
-            static SingleLog instance;
-            return instance;
+            m_clock.Calibrate();
+        }
+
+        void Append(std::uint64_t raw, TimestampPrecision precision, std::string& out)
+        {
+            AppendWallTime(m_clock.ToWallNanos(raw), precision, out);
         }
 
         /**
-         * Destructor
+         * Render wall clock nanoseconds since the epoch
          */
-        ~SingleLog()
+        void AppendWallTime(std::int64_t nanos, TimestampPrecision precision, std::string& out)
         {
+            auto second = nanos / 1000000000;
+            auto fraction = nanos % 1000000000;
+            if (fraction < 0)
             {
-                std::lock_guard<std::mutex> lock(m_consoleLogDequeLock);
-                m_consoleExit = true;
-            }
-            m_consoleCv.notify_all();
-            {
-                std::lock_guard<std::mutex> lock(m_fstreamLogDequeLock);
-                m_fstreamExit = true;
-            }
-            m_fstreamCv.notify_all();
-            if (m_consoleWriter.joinable())
-            {
-                m_consoleWriter.join();
+                second -= 1;
+                fraction += 1000000000;
             }
-            if (m_fstreamWriter.joinable())
+            if (second != m_cachedSecond)
             {
-                m_fstreamWriter.join();
+                Refresh(second);
             }
-            std::lock_guard<std::mutex> lock(m_fstreamLock);
-            if (m_fileOut.is_open())
+            out.append(m_dateTime.data(), m_dateTimeLength);
+            switch (precision)
             {
-                m_fileOut << "\n\n";
-                m_fileOut.close();
+            case TimestampPrecision::Milliseconds:
+                AppendFraction(fraction / 1000000, 3, out);
+                break;
+            case TimestampPrecision::Microseconds:
+                AppendFraction(fraction / 1000, 6, out);
+                break;
+            case TimestampPrecision::Nanoseconds:
+                AppendFraction(fraction, 9, out);
+                break;
+            case TimestampPrecision::Seconds:
+            default:
+                break;
             }
+            out.append(m_zone.data(), m_zoneLength);
         }
 
-        /**
-         * Set the minimum log level for the console
-         * L_TRACE, L_DEBUG, L_INFO, L_NOTICE, L_WARNING, ERROR, L_CRITICAL, L_OFF
-         */
-        void SetConsoleLogLevel(const LogLevel& logLevel)
+    private:
+        void Refresh(std::int64_t second)
         {
-            m_consoleLogLevel.store(logLevel);
+            m_clock.Calibrate();
+            m_cachedSecond = second;
+            std::time_t ttnow = static_cast<std::time_t>(second);
+            tm buf;
+#ifdef WIN32
+            localtime_s(&buf, &ttnow);
+#else
+            localtime_r(&ttnow, &buf);
+#endif
+            m_dateTimeLength = std::strftime(m_dateTime.data(), m_dateTime.size(), "%F %T", &buf);
+            m_zoneLength = std::strftime(m_zone.data(), m_zone.size(), " %z", &buf);
         }
 
-        /**
-         * Set the minimum log level for the log file
-         * L_TRACE, L_DEBUG, L_INFO, L_NOTICE, L_WARNING, ERROR, L_CRITICAL, L_OFF
-         */
-        void SetFileLogLevel(const LogLevel& logLevel)
+        static void AppendFraction(std::int64_t value, std::size_t digits, std::string& out)
         {
-            m_fileLogLevel.store(logLevel);
+            char text[10] = {'.'};
+            for (std::size_t i = digits; i > 0; --i)
+            {
+                text[i] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            }
+            out.append(text, digits + 1);
         }
 
-        /**
-         * Set the path to the log file
-         */
-        void SetLogFilePath(const std::string& filePath)
+        Clock m_clock{};
+        std::int64_t m_cachedSecond{-1};
+        std::array<char, 32> m_dateTime{};
+        std::size_t m_dateTimeLength{0};
+        std::array<char, 16> m_zone{};
+        std::size_t m_zoneLength{0};
+    };
+
+    using DeferredFormatter = void (*)(const char* format, const char* args, std::string& out);
+
+    /**
+     * What a LogRecord holds
+     * Line: text is a finished line, written as is
+     * Message: text is the message, the writer adds timestamp, level and module
+     * Deferred: the writer formats the message from format and the argument bytes captured by the LOGF_* macros
+     * Fields: format is the message and the argument bytes are the key-value pairs captured by the LOG_*_KV macros
+     */
+    enum class RecordKind
+    {
+        Line,
+        Message,
+        Deferred,
+        Fields
+    };
+
+    /**
+     * Per thread pool of fixed size blocks for the memory a LogRecord needs beyond its own footprint: long module
+     * names and messages, spilled key-value fields, and records shared between outputs.
+     * Blocks come from the pool of the thread that logs. Once written they are given back by the writer thread
+     * through a lock-free list that the owning thread reclaims with one exchange, so in steady state logging makes
+     * no calls to malloc and logging threads never contend on the allocator. The size classes are
+     * LoggerPoolSmallestBlock times 1, 4, 16 and 64; larger requests go to operator new.
+     * A pool outlives its thread: when the thread exits it is parked for the next new thread to adopt, so blocks
+     * still queued can always be given back.
+     */
+    class RecordPool final
+    {
+    public:
+        RecordPool() = default;
+        RecordPool(RecordPool const& copy) = delete;
+        RecordPool& operator=(RecordPool const& copy) = delete;
+
+        static void* Allocate(std::size_t bytes)
         {
-            std::lock_guard<std::mutex> lock(m_fstreamLock);
-            m_filePath = filePath;
-            if (m_fileOut.is_open())
+            auto sizeClass = SizeClass(bytes);
+            auto& state = State();
+            if (state.pool == nullptr && !state.exited && sizeClass < LoggerPoolSizeClasses)
             {
-                m_fileOut.close();
+                state.pool = Adopt();
+                thread_local Releaser releaser;
+                (void)releaser;
             }
-            m_fileOut.open(m_filePath, std::ios_base::out);
-            if (m_fileOut.is_open())
+            if (state.pool == nullptr || sizeClass == LoggerPoolSizeClasses)
+            {
+                auto block = static_cast<Block*>(::operator new(sizeof(Block) + bytes));
+                block->pool = nullptr;
+                return block + 1;
+            }
+            auto& pool = *state.pool;
+            Block* block = pool.m_free[sizeClass];
+            if (block == nullptr)
+            {
+                block = pool.m_returned[sizeClass].exchange(nullptr, std::memory_order_acquire);
+            }
+            if (block == nullptr)
             {
-                m_fileOut.rdbuf()->pubsetbuf(m_writeBuffer.data(), LogggerInternalBufferSize);
+                block = static_cast<Block*>(::operator new(sizeof(Block) + ClassSize(sizeClass)));
+                block->pool = &pool;
+                block->sizeClass = sizeClass;
+                block->next = nullptr;
             }
+            pool.m_free[sizeClass] = block->next;
+            return block + 1;
         }
 
-        /**
-         * Set the path to the log file
-         */
-        void SetLogFilePath(const std::wstring& filePath)
+        static void Deallocate(void* data)
         {
-            SetLogFilePath(ToNarrow(filePath));
-        }
-
-        /**
-         * Log the line to console and/or file
-         */
-        void LogIt(LogLevel level, const std::string& line)
+            auto block = static_cast<Block*>(data) - 1;
+            auto pool = block->pool;
+            if (pool == nullptr)
+            {
+                ::operator delete(block);
+            }
+            else if (pool == State().pool)
+            {
+                block->next = pool->m_free[block->sizeClass];
+                pool->m_free[block->sizeClass] = block;
+            }
+            else
+            {
+                auto& returned = pool->m_returned[block->sizeClass];
+                block->next = returned.load(std::memory_order_relaxed);
+                while (!returned.compare_exchange_weak(block->next, block, std::memory_order_release,
+                                                       std::memory_order_relaxed))
+                {
+                }
+            }
+        }
+
+    private:
+        struct alignas(std::max_align_t) Block
+        {
+            RecordPool* pool;
+            Block* next;
+            std::size_t sizeClass;
+        };
+
+        /**
+         * The calling thread's pool, trivially destructible so it can still be read while the thread exits
+         */
+        struct ThreadState
+        {
+            RecordPool* pool;
+            bool exited;
+        };
+
+        /**
+         * Parks the thread's pool when the thread exits, after which its records use operator new
+         */
+        struct Releaser
+        {
+            Releaser() = default;
+            Releaser(Releaser const& copy) = delete;
+            Releaser& operator=(Releaser const& copy) = delete;
+
+            ~Releaser()
+            {
+                auto& state = State();
+                auto& parking = Parking();
+                std::lock_guard<std::mutex> lock(parking.lock);
+                parking.pools.push_back(state.pool);
+                state.pool = nullptr;
+                state.exited = true;
+            }
+        };
+
+        struct ParkedPools
+        {
+            std::mutex lock{};
+            std::vector<RecordPool*> pools{};
+        };
+
+        static ThreadState& State()
+        {
+            thread_local ThreadState state{nullptr, false};
+            return state;
+        }
+
+        static ParkedPools& Parking()
+        {
+            // Never destroyed, writer threads park their pools during static destruction
+            static auto parking = new ParkedPools();
+            return *parking;
+        }
+
+        static RecordPool* Adopt()
+        {
+            auto& parking = Parking();
+            std::lock_guard<std::mutex> lock(parking.lock);
+            if (parking.pools.empty())
+            {
+                return new RecordPool();
+            }
+            auto pool = parking.pools.back();
+            parking.pools.pop_back();
+            return pool;
+        }
+
+        static std::size_t ClassSize(std::size_t sizeClass)
+        {
+            return LoggerPoolSmallestBlock << (2 * sizeClass);
+        }
+
+        static std::size_t SizeClass(std::size_t bytes)
+        {
+            std::size_t sizeClass = 0;
+            while (sizeClass < LoggerPoolSizeClasses && bytes > ClassSize(sizeClass))
+            {
+                ++sizeClass;
+            }
+            return sizeClass;
+        }
+
+        std::array<Block*, LoggerPoolSizeClasses> m_free{};
+        std::array<std::atomic<Block*>, LoggerPoolSizeClasses> m_returned{};
+    };
+
+    /**
+     * Standard allocator drawing from RecordPool
+     */
+    template <typename T>
+    struct PoolAllocator
+    {
+        using value_type = T;
+
+        PoolAllocator() = default;
+
+        template <typename U>
+        PoolAllocator(const PoolAllocator<U>&) noexcept
+        {
+        }
+
+        T* allocate(std::size_t n)
+        {
+            return static_cast<T*>(RecordPool::Allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T* data, std::size_t) noexcept
+        {
+            RecordPool::Deallocate(data);
+        }
+    };
+
+    template <typename T, typename U>
+    bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&)
+    {
+        return true;
+    }
+
+    template <typename T, typename U>
+    bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&)
+    {
+        return false;
+    }
+
+    using PooledString = std::basic_string<char, std::char_traits<char>, PoolAllocator<char>>;
+
+    /**
+     * A queued log message. The timestamp is a raw Clock::Now() value; it also orders messages between queues.
+     */
+    struct LogRecord
+    {
+        std::uint64_t timestamp{0};
+        RecordKind kind{RecordKind::Line};
+        LogLevel level{LogLevel::L_OFF};
+        PooledString module{};
+        PooledString text{};
+        std::uint32_t threadId{0};
+        const char* format{nullptr};
+        DeferredFormatter formatter{nullptr};
+        const char* argTypes{nullptr};
+        std::size_t argsSize{0};
+        alignas(std::max_align_t) std::array<char, LoggerDeferredArgsCapacity> args{};
+        // LOG_*_KV fields too large for args
+        std::vector<std::max_align_t, PoolAllocator<std::max_align_t>> spilledArgs{};
+
+        /**
+         * The captured argument bytes, wherever they are held
+         */
+        const char* ArgsData() const
+        {
+            return spilledArgs.empty() ? args.data() : reinterpret_cast<const char*>(spilledArgs.data());
+        }
+    };
+
+    /**
+     * Small id of the calling thread, the OS thread id where there is one
+     */
+    inline std::uint32_t CurrentThreadId()
+    {
+#ifdef __linux__
+        static thread_local std::uint32_t id{static_cast<std::uint32_t>(::syscall(SYS_gettid))};
+#else
+        static thread_local std::uint32_t id{
+            static_cast<std::uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()))};
+#endif
+        return id;
+    }
+
+    /**
+     * Id of the calling process
+     */
+    inline std::uint32_t CurrentProcessId()
+    {
+#ifdef WIN32
+        return static_cast<std::uint32_t>(::_getpid());
+#else
+        return static_cast<std::uint32_t>(::getpid());
+#endif
+    }
+
+    /**
+     * Copies printf arguments into a LogRecord on the logging thread and reads them back on the writer thread.
+     * Numbers, enums and pointers are copied as raw bytes, strings are copied inline including their terminator.
+     * Anything else could not be handed to printf, so it fails to compile.
+     * address is set for a char pointer in a position the format does not read as %s, see NonStringConversions().
+     */
+    template <typename T, typename Enable = void>
+    struct DeferredArg
+    {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value,
+                      "LOGF_* and LOG_*_KV arguments must be numbers, enums, pointers or strings");
+        using Decoded = T;
+
+        /**
+         * Describes T in the binary log format so values can be decoded without the C++ type
+         */
+        static constexpr char TypeCode()
+        {
+            return std::is_same<T, bool>::value       ? '?'
+                   : std::is_pointer<T>::value        ? 'p'
+                   : std::is_floating_point<T>::value ? (sizeof(T) == sizeof(float)    ? 'f'
+                                                         : sizeof(T) == sizeof(double) ? 'd'
+                                                                                       : 'D')
+                   : sizeof(T) == 1                   ? (std::is_signed<T>::value ? 'b' : 'B')
+                   : sizeof(T) == 2                   ? (std::is_signed<T>::value ? 'h' : 'H')
+                   : sizeof(T) == 4                   ? (std::is_signed<T>::value ? 'i' : 'I')
+                                                      : (std::is_signed<T>::value ? 'l' : 'L');
+        }
+
+        static bool Encode(char*& cursor, const char* end, const T& value, bool)
+        {
+            if (static_cast<std::size_t>(end - cursor) < sizeof(T))
+            {
+                return false;
+            }
+            std::memcpy(cursor, &value, sizeof(T));
+            cursor += sizeof(T);
+            return true;
+        }
+
+        static Decoded Decode(const char*& cursor)
+        {
+            T value;
+            std::memcpy(&value, cursor, sizeof(T));
+            cursor += sizeof(T);
+            return value;
+        }
+    };
+
+    template <typename CharT>
+    struct DeferredStringArg
+    {
+        using Decoded = const CharT*;
+
+        static constexpr char TypeCode()
+        {
+            return sizeof(CharT) == 1 ? 's' : 'w';
+        }
+
+        /**
+         * Length prefixes that stand in for the characters: a null pointer, which the writer prints as "(null)",
+         * and a pointer kept by address for %p, which is followed by the pointer value
+         */
+        static constexpr std::size_t NullString = 0;
+        static constexpr std::size_t Address = ~std::size_t{0};
+
+        static bool Encode(char*& cursor, const char* end, const CharT* value, bool address)
+        {
+            if (value == nullptr || address)
+            {
+                std::size_t marker = NullString;
+                std::size_t size = sizeof(marker);
+                if (address)
+                {
+                    marker = Address;
+                    size += sizeof(value);
+                }
+                if (static_cast<std::size_t>(end - cursor) < size)
+                {
+                    return false;
+                }
+                std::memcpy(cursor, &marker, sizeof(marker));
+                std::memcpy(cursor + sizeof(marker), &value, size - sizeof(marker));
+                cursor += size;
+                return true;
+            }
+            auto length = std::char_traits<CharT>::length(value);
+            return EncodeChars(cursor, end, value, length);
+        }
+
+        static bool Encode(char*& cursor, const char* end, const std::basic_string<CharT>& value, bool)
+        {
+            return EncodeChars(cursor, end, value.c_str(), value.size());
+        }
+
+#if defined(__cpp_lib_string_view)
+        static bool Encode(char*& cursor, const char* end, std::basic_string_view<CharT> value, bool)
+        {
+            return EncodeChars(cursor, end, value.data(), value.size());
+        }
+#endif
+
+        /**
+         * What a null string is printed as, like glibc's printf
+         */
+        static const CharT* NullText()
+        {
+            static const CharT text[] = {'(', 'n', 'u', 'l', 'l', ')', '\0'};
+            return text;
+        }
+
+        static Decoded Decode(const char*& cursor)
+        {
+            std::size_t bytes = 0;
+            std::memcpy(&bytes, cursor, sizeof(bytes));
+            if (bytes == NullString)
+            {
+                cursor += sizeof(bytes);
+                return NullText();
+            }
+            if (bytes == Address)
+            {
+                const CharT* value = nullptr;
+                std::memcpy(&value, cursor + sizeof(bytes), sizeof(value));
+                cursor += sizeof(bytes) + sizeof(value);
+                return value;
+            }
+            const char* chars = cursor + CharsOffset(cursor);
+            cursor = chars + bytes;
+            return reinterpret_cast<const CharT*>(chars);
+        }
+
+    private:
+        /**
+         * Offset from the length prefix to the characters, padded so wide strings can be read in place.
+         * LogRecord::args is suitably aligned, so padding by address gives the same result on both threads.
+         */
+        static std::size_t CharsOffset(const char* cursor)
+        {
+            auto address = reinterpret_cast<std::uintptr_t>(cursor) + sizeof(std::size_t);
+            return sizeof(std::size_t) + (alignof(CharT) - address % alignof(CharT)) % alignof(CharT);
+        }
+
+        static bool EncodeChars(char*& cursor, const char* end, const CharT* value, std::size_t length)
+        {
+            std::size_t bytes = (length + 1) * sizeof(CharT);
+            std::size_t offset = CharsOffset(cursor);
+            if (static_cast<std::size_t>(end - cursor) < offset + bytes)
+            {
+                return false;
+            }
+            const CharT terminator{};
+            std::memcpy(cursor, &bytes, sizeof(bytes));
+            std::memcpy(cursor + offset, value, length * sizeof(CharT));
+            std::memcpy(cursor + offset + length * sizeof(CharT), &terminator, sizeof(CharT));
+            cursor += offset + bytes;
+            return true;
+        }
+    };
+
+    template <>
+    struct DeferredArg<const char*> : DeferredStringArg<char>
+    {
+    };
+
+    template <>
+    struct DeferredArg<char*> : DeferredStringArg<char>
+    {
+    };
+
+    template <>
+    struct DeferredArg<std::string> : DeferredStringArg<char>
+    {
+    };
+
+    template <>
+    struct DeferredArg<const wchar_t*> : DeferredStringArg<wchar_t>
+    {
+    };
+
+    template <>
+    struct DeferredArg<wchar_t*> : DeferredStringArg<wchar_t>
+    {
+    };
+
+    template <>
+    struct DeferredArg<std::wstring> : DeferredStringArg<wchar_t>
+    {
+    };
+
+#if defined(__cpp_lib_string_view)
+    template <>
+    struct DeferredArg<std::string_view> : DeferredStringArg<char>
+    {
+    };
+
+    template <>
+    struct DeferredArg<std::wstring_view> : DeferredStringArg<wchar_t>
+    {
+    };
+#endif
+
+    /**
+     * nullptr is captured as a null void pointer, which is what printf receives for it
+     */
+    template <>
+    struct DeferredArg<std::nullptr_t> : DeferredArg<const void*>
+    {
+        static bool Encode(char*& cursor, const char* end, std::nullptr_t, bool)
+        {
+            return DeferredArg<const void*>::Encode(cursor, end, nullptr, false);
+        }
+    };
+
+    /**
+     * Pass std::string arguments to printf as C strings, everything else unchanged
+     */
+    template <typename T>
+    const T& PrintfArg(const T& value)
+    {
+        return value;
+    }
+
+    inline const char* PrintfArg(const std::string& value)
+    {
+        return value.c_str();
+    }
+
+    inline const wchar_t* PrintfArg(const std::wstring& value)
+    {
+        return value.c_str();
+    }
+
+    /**
+     * Copy string views, which are not terminated, into strings for PrintfArg(), everything else unchanged
+     */
+    template <typename T>
+    const T& TerminatedArg(const T& value)
+    {
+        return value;
+    }
+
+#if defined(__cpp_lib_string_view)
+    inline std::string TerminatedArg(std::string_view value)
+    {
+        return std::string(value);
+    }
+
+    inline std::wstring TerminatedArg(std::wstring_view value)
+    {
+        return std::wstring(value);
+    }
+#endif
+
+    /**
+     * Copy each argument into buffer, returns false if they do not fit.
+     * Bit i of addresses captures the i-th argument by address if it is a char pointer.
+     */
+    inline bool EncodeDeferredArgs(char*&, const char*, std::uint64_t)
+    {
+        return true;
+    }
+
+    template <typename Arg, typename... Args>
+    bool EncodeDeferredArgs(char*& cursor, const char* end, std::uint64_t addresses, const Arg& arg,
+                            const Args&... args)
+    {
+        return DeferredArg<typename std::decay<Arg>::type>::Encode(cursor, end, arg, (addresses & 1) != 0) &&
+               EncodeDeferredArgs(cursor, end, addresses >> 1, args...);
+    }
+
+    /**
+     * True if any of Args is a char or wchar_t pointer, the only arguments whose capture depends on the format
+     */
+    template <typename... Args>
+    constexpr bool HasCharPointers()
+    {
+        const bool pointers[] = {(std::is_pointer<Args>::value && DeferredArg<Args>::TypeCode() != 'p')..., false};
+        for (bool pointer : pointers)
+        {
+            if (pointer)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Bit i is set if the i-th argument of a printf format is read by anything but %s, e.g. %p or a '*' width.
+     * A char pointer there is captured by address rather than copied as text.
+     */
+    inline std::uint64_t NonStringConversions(const char* format)
+    {
+        std::uint64_t mask = 0;
+        unsigned index = 0;
+        for (const char* c = format; *c != '\0'; ++c)
+        {
+            if (*c != '%' || *++c == '%')
+            {
+                continue;
+            }
+            for (; *c != '\0' && std::strchr("diouxXeEfFgGaAcspn", *c) == nullptr; ++c)
+            {
+                if (*c == '*')
+                {
+                    mask |= index < 64 ? std::uint64_t{1} << index : 0;
+                    ++index;
+                }
+            }
+            if (*c == '\0')
+            {
+                break;
+            }
+            mask |= *c != 's' && index < 64 ? std::uint64_t{1} << index : 0;
+            ++index;
+        }
+        return mask;
+    }
+
+    /**
+     * snprintf onto the end of out, into its spare capacity where the result fits.
+     * If snprintf fails the format is appended as it is, followed by StringTools::FormatErrorMarker.
+     */
+    template <typename... Values>
+    void AppendFormat(std::string& out, const char* format, const Values&... values)
+    {
+        auto start = out.size();
+        auto room = std::max<std::size_t>(out.capacity() - start, 64);
+        out.resize(start + room);
+        auto length = std::snprintf(&out[start], room + 1, format, values...);
+        if (length < 0)
+        {
+            out.resize(start);
+            out += format;
+            out += StringTools::FormatErrorMarker;
+            return;
+        }
+        if (static_cast<std::size_t>(length) > room)
+        {
+            out.resize(start + static_cast<std::size_t>(length));
+            std::snprintf(&out[start], static_cast<std::size_t>(length) + 1, format, values...);
+        }
+        out.resize(start + static_cast<std::size_t>(length));
+    }
+
+    template <typename... Args, std::size_t... Index>
+    void FormatDeferredArgs(const char* format, const char* args, std::string& out, std::index_sequence<Index...>)
+    {
+        // Braced initialisation guarantees the arguments are decoded left to right
+        const char* cursor = args;
+        std::tuple<typename DeferredArg<Args>::Decoded...> values{DeferredArg<Args>::Decode(cursor)...};
+        AppendFormat(out, format, std::get<Index>(values)...);
+    }
+
+    /**
+     * One type code per argument, e.g. "si" for a string and an int
+     */
+    template <typename... Args>
+    const char* DeferredArgTypes()
+    {
+        static const char argTypes[] = {DeferredArg<Args>::TypeCode()..., '\0'};
+        return argTypes;
+    }
+
+    /**
+     * Rebuild the argument list captured for Args and run the format onto the end of out, on the writer thread
+     */
+    template <typename... Args>
+    void FormatDeferred(const char* format, const char* args, std::string& out)
+    {
+        FormatDeferredArgs<Args...>(format, args, out, std::index_sequence_for<Args...>{});
+    }
+
+    /**
+     * True if the LOG_*_KV argument types are string keys each followed by a value that can be captured
+     */
+    template <typename... Fields>
+    constexpr bool ValidFieldTypes()
+    {
+        const char codes[] = {DeferredArg<Fields>::TypeCode()..., '\0'};
+        for (std::size_t i = 0; i < sizeof...(Fields); ++i)
+        {
+            if (i % 2 == 0 && codes[i] != 's')
+            {
+                return false;
+            }
+        }
+        return sizeof...(Fields) % 2 == 0;
+    }
+
+    /**
+     * One decoded key-value field or printf argument, type is its DeferredArg type code
+     */
+    struct FieldValue
+    {
+        char type{'x'};
+        std::int64_t signedValue{0};
+        std::uint64_t unsignedValue{0};
+        long double floatValue{0};
+        const void* pointerValue{nullptr};
+        const char* stringValue{nullptr};
+        const wchar_t* wideValue{nullptr};
+    };
+
+    /**
+     * Copy text into out as a JSON string, escaping in the same pass: unescaped runs are appended whole
+     */
+    inline void AppendJsonString(std::string& out, const char* text, std::size_t length)
+    {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        std::size_t run = 0;
+        for (std::size_t i = 0; i < length; ++i)
+        {
+            auto c = static_cast<unsigned char>(text[i]);
+            if (c >= 0x20 && c != '"' && c != '\\')
+            {
+                continue;
+            }
+            out.append(text + run, i - run);
+            run = i + 1;
+            switch (c)
+            {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xF];
+                break;
+            }
+        }
+        out.append(text + run, length - run);
+        out += '"';
+    }
+
+    /**
+     * Append a string value, quoted as JSON for OutputFormat::Json. The text formats leave it bare unless it is
+     * empty or holds a space, '=', '"' or a control character, then it is quoted the same way.
+     */
+    inline void AppendFieldString(std::string& out, const char* text, std::size_t length, OutputFormat format)
+    {
+        bool quote = format == OutputFormat::Json || length == 0;
+        for (std::size_t i = 0; i < length && !quote; ++i)
+        {
+            auto c = static_cast<unsigned char>(text[i]);
+            quote = c <= ' ' || c == '=' || c == '"';
+        }
+        if (quote)
+        {
+            AppendJsonString(out, text, length);
+        }
+        else
+        {
+            out.append(text, length);
+        }
+    }
+
+    /**
+     * Append a field value. Floating point values keep the digits their type guarantees to round trip, and
+     * NaN and infinity, which JSON cannot represent, are written to JSON as null.
+     */
+    inline void AppendFieldValue(std::string& out, const FieldValue& value, OutputFormat format, std::string& scratch)
+    {
+        char buffer[64];
+        int length = 0;
+        switch (value.type)
+        {
+        case '?':
+            out += value.unsignedValue != 0 ? "true" : "false";
+            return;
+        case 'b':
+        case 'h':
+        case 'i':
+        case 'l':
+            length = std::snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(value.signedValue));
+            break;
+        case 'B':
+        case 'H':
+        case 'I':
+        case 'L':
+            length =
+                std::snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(value.unsignedValue));
+            break;
+        case 'f':
+        case 'd':
+        case 'D':
+            if (format == OutputFormat::Json && !std::isfinite(value.floatValue))
+            {
+                out += "null";
+                return;
+            }
+            length = std::snprintf(buffer, sizeof(buffer), "%.*Lg",
+                                   value.type == 'f'   ? std::numeric_limits<float>::max_digits10
+                                   : value.type == 'd' ? std::numeric_limits<double>::max_digits10
+                                                       : std::numeric_limits<long double>::max_digits10,
+                                   value.floatValue);
+            break;
+        case 'p':
+            length = std::snprintf(buffer, sizeof(buffer), "%p", value.pointerValue);
+            AppendFieldString(out, buffer, length > 0 ? static_cast<std::size_t>(length) : 0, format);
+            return;
+        case 's':
+            AppendFieldString(out, value.stringValue, std::strlen(value.stringValue), format);
+            return;
+        case 'w':
+            scratch.clear();
+            AppendUtf8(value.wideValue, std::wcslen(value.wideValue), scratch);
+            AppendFieldString(out, scratch.data(), scratch.size(), format);
+            return;
+        default:
+            out += format == OutputFormat::Json ? "null" : "?";
+            return;
+        }
+        if (length > 0)
+        {
+            out.append(buffer, std::min(static_cast<std::size_t>(length), sizeof(buffer) - 1));
+        }
+    }
+
+    /**
+     * Append one field: ,"key":value for OutputFormat::Json, otherwise a space and key=value
+     */
+    inline void AppendField(std::string& out, const char* key, const FieldValue& value, OutputFormat format,
+                            std::string& scratch)
+    {
+        if (format == OutputFormat::Json)
+        {
+            out += ',';
+            AppendJsonString(out, key, std::strlen(key));
+            out += ':';
+        }
+        else
+        {
+            out += ' ';
+            out += key;
+            out += '=';
+        }
+        AppendFieldValue(out, value, format, scratch);
+    }
+
+    /**
+     * Read back one value captured by EncodeDeferredArgs, type is its DeferredArg type code
+     */
+    inline FieldValue DecodeFieldValue(const char*& cursor, char type)
+    {
+        FieldValue value{};
+        value.type = type;
+        switch (type)
+        {
+        case '?':
+            value.unsignedValue = DeferredArg<bool>::Decode(cursor) ? 1 : 0;
+            break;
+        case 'b':
+            value.signedValue = DeferredArg<std::int8_t>::Decode(cursor);
+            break;
+        case 'B':
+            value.unsignedValue = DeferredArg<std::uint8_t>::Decode(cursor);
+            break;
+        case 'h':
+            value.signedValue = DeferredArg<std::int16_t>::Decode(cursor);
+            break;
+        case 'H':
+            value.unsignedValue = DeferredArg<std::uint16_t>::Decode(cursor);
+            break;
+        case 'i':
+            value.signedValue = DeferredArg<std::int32_t>::Decode(cursor);
+            break;
+        case 'I':
+            value.unsignedValue = DeferredArg<std::uint32_t>::Decode(cursor);
+            break;
+        case 'l':
+            value.signedValue = DeferredArg<std::int64_t>::Decode(cursor);
+            break;
+        case 'L':
+            value.unsignedValue = DeferredArg<std::uint64_t>::Decode(cursor);
+            break;
+        case 'f':
+            value.floatValue = DeferredArg<float>::Decode(cursor);
+            break;
+        case 'd':
+            value.floatValue = DeferredArg<double>::Decode(cursor);
+            break;
+        case 'D':
+            value.floatValue = DeferredArg<long double>::Decode(cursor);
+            break;
+        case 'p':
+            value.pointerValue = DeferredArg<const void*>::Decode(cursor);
+            break;
+        case 's':
+            value.stringValue = DeferredArg<const char*>::Decode(cursor);
+            break;
+        case 'w':
+            value.wideValue = DeferredArg<const wchar_t*>::Decode(cursor);
+            break;
+        default:
+            break;
+        }
+        return value;
+    }
+
+    /**
+     * Append every key-value pair captured by the LOG_*_KV macros, see AppendField()
+     */
+    inline void AppendFields(std::string& out, const char* args, const char* argTypes, OutputFormat format,
+                             std::string& scratch)
+    {
+        const char* cursor = args;
+        for (const char* type = argTypes; type[0] != '\0' && type[1] != '\0'; type += 2)
+        {
+            const char* key = DeferredArg<const char*>::Decode(cursor);
+            AppendField(out, key, DecodeFieldValue(cursor, type[1]), format, scratch);
+        }
+    }
+
+    /**
+     * Builds the common format log line for a record on the writer thread
+     */
+    class LineFormatter final
+    {
+    public:
+        /**
+         * The finished line for record, valid until the next call
+         */
+        const std::string& Format(const LogRecord& record, TimestampPrecision precision)
+        {
+            m_line.clear();
+            if (record.kind == RecordKind::Line)
+            {
+                m_line.append(record.text.data(), record.text.size());
+                return m_line;
+            }
+            m_timestamp.Append(record.timestamp, precision, m_line);
+            m_line += "  <";
+            m_line += LevelName(record.level);
+            m_line += ">  ";
+            m_line.append(record.module.data(), record.module.size());
+            m_line += ":  ";
+            if (record.kind == RecordKind::Deferred)
+            {
+                record.formatter(record.format, record.args.data(), m_line);
+            }
+            else if (record.kind == RecordKind::Fields)
+            {
+                m_line += record.format;
+                AppendFields(m_line, record.ArgsData(), record.argTypes, OutputFormat::Text, m_scratch);
+            }
+            else
+            {
+                m_line.append(record.text.data(), record.text.size());
+            }
+            m_line += "\n";
+            return m_line;
+        }
+
+    private:
+        TimestampFormatter m_timestamp{};
+        std::string m_line{};
+        std::string m_scratch{};
+    };
+
+    /**
+     * Writes records as JSON Lines or logfmt straight into the writer's output buffer.
+     * Strings are escaped while they are copied and key-value fields are rendered from the captured bytes, so
+     * only printf style messages need a temporary string.
+     */
+    class StructuredFormatter final
+    {
+    public:
+        /**
+         * Append record to out in format, OutputFormat::Json or OutputFormat::Logfmt
+         */
+        void Append(const LogRecord& record, OutputFormat format, TimestampPrecision precision, std::string& out)
+        {
+            bool json = format == OutputFormat::Json;
+            m_scratch.clear();
+            m_timestamp.Append(record.timestamp, precision, m_scratch);
+            out += json ? "{\"time\":" : "time=";
+            AppendFieldString(out, m_scratch.data(), m_scratch.size(), format);
+            out += json ? ",\"level\":\"" : " level=";
+            out += LevelName(record.level);
+            out += json ? "\",\"thread\":" : " thread=";
+            FieldValue thread{};
+            thread.type = 'I';
+            thread.unsignedValue = record.threadId;
+            AppendFieldValue(out, thread, format, m_scratch);
+            out += json ? ",\"module\":" : " module=";
+            AppendFieldString(out, record.module.data(), record.module.size(), format);
+            out += json ? ",\"message\":" : " msg=";
+            switch (record.kind)
+            {
+            case RecordKind::Line: {
+                // A finished line from LogIt(), keep it whole apart from the line break
+                auto length = record.text.size();
+                if (length > 0 && record.text[length - 1] == '\n')
+                {
+                    --length;
+                }
+                AppendFieldString(out, record.text.data(), length, format);
+                break;
+            }
+            case RecordKind::Deferred:
+                m_message.clear();
+                record.formatter(record.format, record.args.data(), m_message);
+                AppendFieldString(out, m_message.data(), m_message.size(), format);
+                break;
+            case RecordKind::Fields:
+                AppendFieldString(out, record.format, std::strlen(record.format), format);
+                AppendFields(out, record.ArgsData(), record.argTypes, format, m_scratch);
+                break;
+            case RecordKind::Message:
+            default:
+                AppendFieldString(out, record.text.data(), record.text.size(), format);
+                break;
+            }
+            out += json ? "}\n" : "\n";
+        }
+
+    private:
+        TimestampFormatter m_timestamp{};
+        std::string m_scratch{};
+        std::string m_message{};
+    };
+
+    /**
+     * A record going to several outputs, shared rather than copied into each of their queues.
+     * The first writer to need the text line formats it here for the others.
+     */
+    struct SharedRecord
+    {
+        explicit SharedRecord(LogRecord&& _record) : record(std::move(_record))
+        {
+        }
+
+        LogRecord record;
+        std::atomic<int> lineState{0}; // 0: not formatted, 1: being formatted, 2: line is ready
+        std::string line{};
+    };
+
+    /**
+     * What the queues hold: a record going to one output is moved in whole, one going to several is shared
+     */
+    class QueuedRecord final
+    {
+    public:
+        QueuedRecord() = default;
+
+        explicit QueuedRecord(LogRecord&& record) : m_record(std::move(record))
+        {
+        }
+
+        explicit QueuedRecord(std::shared_ptr<SharedRecord> shared) : m_shared(std::move(shared))
+        {
+        }
+
+        const LogRecord& Get() const
+        {
+            return m_shared ? m_shared->record : m_record;
+        }
+
+        /**
+         * The text line for the record, formatted only once between all the writers sharing it.
+         * A writer that finds another one formatting the line right now formats its own copy rather than wait.
+         */
+        const std::string& Line(LineFormatter& formatter, TimestampPrecision precision) const
+        {
+            if (!m_shared || m_shared->record.kind == RecordKind::Line)
+            {
+                return formatter.Format(Get(), precision);
+            }
+            int state = m_shared->lineState.load(std::memory_order_acquire);
+            if (state == 2)
+            {
+                return m_shared->line;
+            }
+            if (state == 0 && m_shared->lineState.compare_exchange_strong(state, 1, std::memory_order_acquire))
+            {
+                m_shared->line = formatter.Format(m_shared->record, precision);
+                m_shared->lineState.store(2, std::memory_order_release);
+                return m_shared->line;
+            }
+            return formatter.Format(m_shared->record, precision);
+        }
+
+    private:
+        LogRecord m_record{};
+        std::shared_ptr<SharedRecord> m_shared{};
+    };
+
+    /**
+     * The binary log file layout, all integers in host byte order.
+     * A file starts with Magic, a u32 Version and one byte each of sizeof(wchar_t), sizeof(long) and sizeof(void*).
+     * Then follow entries, each starting with a one byte entry type:
+     * CallSite:  u32 id, u16 length + module, u16 length + format, u16 length + argument type codes.
+     *            Defined once per file before the first record that uses it. Type codes starting with '=' mark a
+     *            LOG_*_KV call site: the format is the message and the arguments are alternating keys and values.
+     * Record:    i64 wall clock nanoseconds, u16 level, u32 thread id, u32 call site id, u32 length + payload.
+     *            The payload is the argument bytes for a call site with a format, otherwise the message text.
+     *            Call site 0 is a finished line from LogIt().
+     * Version 2 added key-value call sites.
+     */
+    namespace BinaryFormat
+    {
+        constexpr char Magic[8] = {'S', 'L', 'O', 'G', 'B', 'I', 'N', '\0'};
+        constexpr std::uint32_t Version = 2;
+        constexpr char CallSite = 'D';
+        constexpr char Record = 'R';
+    } // namespace BinaryFormat
+
+    /**
+     * Encodes records in the binary log format on the file writer thread.
+     * Call sites are interned on first use so every later record is a fixed size header plus its raw arguments.
+     */
+    class BinaryEncoder final
+    {
+    public:
+        BinaryEncoder()
+        {
+            m_clock.Calibrate();
+        }
+
+        /**
+         * File header followed by every call site seen so far, written at the start of each file
+         */
+        void AppendPreamble(std::string& out) const
+        {
+            out.append(BinaryFormat::Magic, sizeof(BinaryFormat::Magic));
+            Put(out, BinaryFormat::Version);
+            Put(out, static_cast<std::uint8_t>(sizeof(wchar_t)));
+            Put(out, static_cast<std::uint8_t>(sizeof(long)));
+            Put(out, static_cast<std::uint8_t>(sizeof(void*)));
+            out += m_callSiteEntries;
+        }
+
+        void Append(const LogRecord& record, std::string& out)
+        {
+            auto nanos = m_clock.ToWallNanos(record.timestamp);
+            if (nanos / 1000000000 != m_calibratedSecond)
+            {
+                m_clock.Calibrate();
+                m_calibratedSecond = nanos / 1000000000;
+            }
+            std::uint32_t callSite = 0;
+            if (record.kind != RecordKind::Line)
+            {
+                callSite = CallSiteId(record, out);
+            }
+            out += BinaryFormat::Record;
+            Put(out, nanos);
+            Put(out, static_cast<std::uint16_t>(record.level));
+            Put(out, record.threadId);
+            Put(out, callSite);
+            if (record.kind == RecordKind::Deferred || record.kind == RecordKind::Fields)
+            {
+                Put(out, static_cast<std::uint32_t>(record.argsSize));
+                out.append(record.ArgsData(), record.argsSize);
+            }
+            else
+            {
+                Put(out, static_cast<std::uint32_t>(record.text.size()));
+                out.append(record.text.data(), record.text.size());
+            }
+        }
+
+    private:
+        template <typename T>
+        static void Put(std::string& out, T value)
+        {
+            char bytes[sizeof(T)];
+            std::memcpy(bytes, &value, sizeof(T));
+            out.append(bytes, sizeof(T));
+        }
+
+        static void PutString(std::string& out, const char* text, std::size_t length)
+        {
+            length = std::min<std::size_t>(length, 0xFFFF);
+            Put(out, static_cast<std::uint16_t>(length));
+            out.append(text, length);
+        }
+
+        /**
+         * Id of the record's module and format, defining it in out the first time it is seen
+         */
+        std::uint32_t CallSiteId(const LogRecord& record, std::string& out)
+        {
+            bool fields = record.kind == RecordKind::Fields;
+            const char* format = record.kind == RecordKind::Deferred || fields ? record.format : nullptr;
+            // Reuse the key's buffer, the lookup runs for every record
+            std::get<0>(m_key).assign(record.module.data(), record.module.size());
+            std::get<1>(m_key) = format;
+            std::get<2>(m_key) = fields;
+            auto found = m_callSites.find(m_key);
+            if (found != m_callSites.end())
+            {
+                return found->second;
+            }
+            auto id = static_cast<std::uint32_t>(m_callSites.size() + 1);
+            m_callSites.emplace(m_key, id);
+
+            std::string entry;
+            entry += BinaryFormat::CallSite;
+            Put(entry, id);
+            PutString(entry, record.module.data(), record.module.size());
+            std::string argTypes = fields ? "=" : "";
+            argTypes += format != nullptr ? record.argTypes : "";
+            format = format != nullptr ? format : "";
+            PutString(entry, format, std::strlen(format));
+            PutString(entry, argTypes.data(), argTypes.size());
+            m_callSiteEntries += entry;
+            out += entry;
+            return id;
+        }
+
+        Clock m_clock{};
+        std::int64_t m_calibratedSecond{0};
+        std::map<std::tuple<std::string, const char*, bool>, std::uint32_t> m_callSites{};
+        std::tuple<std::string, const char*, bool> m_key{};
+        std::string m_callSiteEntries{};
+    };
+
+    /**
+     * Latencies in nanoseconds, bucket i counts samples below 2^i ns (the last bucket also takes anything larger)
+     */
+    struct LatencyHistogram
+    {
+        std::array<std::uint64_t, 40> buckets{};
+        std::uint64_t count{0};
+
+        /**
+         * Upper bound in nanoseconds of the bucket holding the given percentile, 0 - 100
+         */
+        std::uint64_t Percentile(double percentile) const
+        {
+            auto rank = static_cast<std::uint64_t>(percentile / 100.0 * static_cast<double>(count));
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < buckets.size(); ++i)
+            {
+                seen += buckets[i];
+                if (seen > rank || (seen == count && seen > 0))
+                {
+                    return std::uint64_t{1} << i;
+                }
+            }
+            return 0;
+        }
+    };
+
+    /**
+     * Counters for one output, see SingleLog::GetStats()
+     */
+    struct SinkStats
+    {
+        std::uint64_t enqueued{0};        // messages accepted onto the queue
+        std::uint64_t written{0};         // messages handed to the output
+        std::uint64_t dropped{0};         // messages discarded by the overflow policy
+        std::uint64_t bytesWritten{0};    // bytes handed to the output
+        std::uint64_t writeErrors{0};     // writes the output failed
+        std::uint64_t queueDepth{0};      // messages waiting for the writer
+        std::uint64_t queueHighWater{0};  // most messages the writer has found waiting at once
+        std::uint64_t writerBusyNanos{0}; // time the writer thread spent draining, formatting and writing
+        LatencyHistogram queueLatency{};  // from the logging call until the writer takes the message off the queue
+        LatencyHistogram writeLatency{};  // of each batched write to the output, including the flush
+    };
+
+    /**
+     * A snapshot of the logger's counters
+     */
+    struct LoggerStats
+    {
+        SinkStats console{};
+        SinkStats file{};
+        std::vector<SinkStats> sinks{}; // in the order they were added
+        std::uint64_t traceSpans{0};        // LOG_FUNCTION_TRACE scopes written to trace files
+        std::uint64_t traceSpansDropped{0}; // scopes dropped because their thread's trace buffer was full
+    };
+
+    /**
+     * Relaxed counter spread over cache lines by thread, so logging threads incrementing it rarely share a line
+     */
+    class StripedCounter final
+    {
+    public:
+        StripedCounter() = default;
+        StripedCounter(StripedCounter const& copy) = delete;
+        StripedCounter& operator=(StripedCounter const& copy) = delete;
+
+        void Increment()
+        {
+            m_stripes[CurrentThreadId() % m_stripes.size()].value.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::uint64_t Load() const
+        {
+            std::uint64_t total = 0;
+            for (const auto& stripe : m_stripes)
+            {
+                total += stripe.value.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+
+    private:
+        struct alignas(CacheLineSize) Stripe
+        {
+            std::atomic<std::uint64_t> value{0};
+        };
+
+        std::array<Stripe, 16> m_stripes{};
+    };
+
+    /**
+     * Records latencies into a LatencyHistogram with relaxed atomics, so it can be read while a writer records
+     */
+    class LatencyRecorder final
+    {
+    public:
+        LatencyRecorder() = default;
+        LatencyRecorder(LatencyRecorder const& copy) = delete;
+        LatencyRecorder& operator=(LatencyRecorder const& copy) = delete;
+
+        void Record(std::int64_t nanos)
+        {
+            std::size_t bucket = 0;
+            while (bucket + 1 < m_buckets.size() && nanos >= (std::int64_t{1} << bucket))
+            {
+                ++bucket;
+            }
+            m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        LatencyHistogram Snapshot() const
+        {
+            LatencyHistogram histogram;
+            for (std::size_t i = 0; i < m_buckets.size(); ++i)
+            {
+                histogram.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+                histogram.count += histogram.buckets[i];
+            }
+            return histogram;
+        }
+
+    private:
+        std::array<std::atomic<std::uint64_t>, 40> m_buckets{};
+    };
+
+    /**
+     * Counters kept by a writer thread. Only the writer updates them, GetStats() reads them at any time.
+     */
+    struct WriterStats
+    {
+        std::atomic<std::uint64_t> written{0};
+        std::atomic<std::uint64_t> bytesWritten{0};
+        std::atomic<std::uint64_t> writeErrors{0};
+        std::atomic<std::uint64_t> busyNanos{0};
+        LatencyRecorder queueLatency{};
+        LatencyRecorder writeLatency{};
+    };
+
+    /**
+     * Bounded lock-free multi-producer/single-consumer ring buffer.
+     * Based on Dmitry Vyukov's bounded MPMC queue. Every cell carries a sequence number, so producers only contend on
+     * the tail index and never on a lock. Pops keep the MPMC compare-and-swap on the head index so a producer can
+     * evict the oldest value while the consumer is reading.
+     * ref: https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+     */
+    template <typename T>
+    class MpscRingBuffer final
+    {
+    public:
+        explicit MpscRingBuffer(std::size_t capacity) : m_mask(RoundUpPowerOfTwo(capacity) - 1)
+        {
+        }
+
+        MpscRingBuffer(MpscRingBuffer const& copy) = delete;
+        MpscRingBuffer& operator=(MpscRingBuffer const& copy) = delete;
+
+        /**
+         * Allocate the cells, which the constructor leaves to this so an unused buffer costs nothing.
+         * Call before the buffer is handed to any producer or consumer.
+         */
+        void Allocate()
+        {
+            if (m_cells)
+            {
+                return;
+            }
+            m_cells.reset(new Cell[m_mask + 1]);
+            for (std::size_t i = 0; i <= m_mask; ++i)
+            {
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * Push a value, returns false without moving from value if the buffer already holds limit values
+         */
+        bool TryPush(T&& value, std::size_t limit)
+        {
+            Cell* cell = nullptr;
+            auto pos = m_tail.load(std::memory_order_relaxed);
+            while (true)
+            {
+                cell = &m_cells[pos & m_mask];
+                auto seq = cell->sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+                if (diff == 0)
+                {
+                    // The head is only read when a limit below the allocated size is set
+                    if (limit <= m_mask && pos - m_head.load(std::memory_order_relaxed) >= limit)
+                    {
+                        return false;
+                    }
+                    if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = m_tail.load(std::memory_order_relaxed);
+                }
+            }
+            cell->value = std::move(value);
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Pop the oldest value, returns false if the buffer is empty
+         */
+        bool TryPop(T& value)
+        {
+            Cell* cell = nullptr;
+            auto pos = m_head.load(std::memory_order_relaxed);
+            while (true)
+            {
+                cell = &m_cells[pos & m_mask];
+                auto seq = cell->sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+                if (diff == 0)
+                {
+                    if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = m_head.load(std::memory_order_relaxed);
+                }
+            }
+            value = std::move(cell->value);
+            cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * True when the next value is not yet available to the consumer
+         */
+        bool Empty() const
+        {
+            auto pos = m_head.load(std::memory_order_relaxed);
+            return m_cells[pos & m_mask].sequence.load(std::memory_order_acquire) != pos + 1;
+        }
+
+        std::size_t Capacity() const
+        {
+            return m_mask + 1;
+        }
+
+        /**
+         * Number of values pushed, or claimed by a push still in progress, since the buffer was created
+         */
+        std::size_t PushedCount() const
+        {
+            return m_tail.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Number of values popped since the buffer was created
+         */
+        std::size_t PoppedCount() const
+        {
+            return m_head.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<std::size_t> sequence{0};
+            T value{};
+        };
+
+        const std::size_t m_mask;
+        std::unique_ptr<Cell[]> m_cells{};
+        alignas(CacheLineSize) std::atomic<std::size_t> m_tail{0};
+        alignas(CacheLineSize) std::atomic<std::size_t> m_head{0};
+    };
+
+    /**
+     * The WakeupPolicy and its settings, read by a writer each time it is about to wait
+     */
+    struct WriterWakeup
+    {
+        WakeupPolicy policy{WakeupPolicy::Park};
+        std::uint32_t spins{0};
+        std::chrono::nanoseconds pollInterval{0};
+    };
+
+    /**
+     * Parks a writer thread while its queue is empty.
+     * Producers only take the mutex when the writer is actually parked, so the logging fast path stays lock free.
+     */
+    class WriterSignal final
+    {
+    public:
+        WriterSignal() = default;
+        WriterSignal(WriterSignal const& copy) = delete;
+        WriterSignal& operator=(WriterSignal const& copy) = delete;
+
+        /**
+         * Wake the writer if it is parked
+         */
+        void Notify()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_waiting.load(std::memory_order_relaxed))
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_cv.notify_one();
+            }
+        }
+
+        /**
+         * Park the calling writer until ready() returns true. With WakeupPolicy::Poll it sleeps for the poll
+         * interval instead and may return before ready() is true.
+         */
+        template <typename Predicate>
+        void Wait(Predicate ready, const WriterWakeup& wakeup = WriterWakeup{})
+        {
+            if (Spin(ready, wakeup))
+            {
+                return;
+            }
+            if (wakeup.policy == WakeupPolicy::Poll)
+            {
+                std::this_thread::sleep_for(wakeup.pollInterval);
+                return;
+            }
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_waiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_cv.wait(lock, ready);
+            m_waiting.store(false, std::memory_order_relaxed);
+        }
+
+        /**
+         * Park the calling writer until ready() returns true or timeout passes
+         */
+        template <typename Predicate>
+        void WaitFor(Predicate ready, std::chrono::nanoseconds timeout, const WriterWakeup& wakeup = WriterWakeup{})
+        {
+            if (Spin(ready, wakeup))
+            {
+                return;
+            }
+            if (wakeup.policy == WakeupPolicy::Poll)
+            {
+                std::this_thread::sleep_for(std::min(timeout, wakeup.pollInterval));
+                return;
+            }
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_waiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_cv.wait_for(lock, timeout, ready);
+            m_waiting.store(false, std::memory_order_relaxed);
+        }
+
+    private:
+        /**
+         * With WakeupPolicy::SpinThenPark, check ready() up to the spin budget, returning true once it is
+         */
+        template <typename Predicate>
+        static bool Spin(Predicate& ready, const WriterWakeup& wakeup)
+        {
+            if (wakeup.policy != WakeupPolicy::SpinThenPark)
+            {
+                return false;
+            }
+            for (std::uint32_t i = 0; i < wakeup.spins; ++i)
+            {
+                if (ready())
+                {
+                    return true;
+                }
+                CpuRelax();
+            }
+            return false;
+        }
+
+        std::mutex m_lock{};
+        std::condition_variable m_cv{};
+        std::atomic<bool> m_waiting{false};
+    };
+
+    /**
+     * Bounded lock-free single-producer/single-consumer ring buffer.
+     * Each side caches the other side's index so the shared cache lines are only touched when the cache runs out.
+     */
+    template <typename T>
+    class SpscRingBuffer final
+    {
+    public:
+        explicit SpscRingBuffer(std::size_t capacity)
+            : m_mask(RoundUpPowerOfTwo(capacity) - 1), m_values(new T[m_mask + 1])
+        {
+        }
+
+        SpscRingBuffer(SpscRingBuffer const& copy) = delete;
+        SpscRingBuffer& operator=(SpscRingBuffer const& copy) = delete;
+
+        /**
+         * Push a value, returns false without moving from value if the buffer already holds limit values.
+         * Producer thread only.
+         */
+        bool TryPush(T&& value, std::size_t limit)
+        {
+            limit = std::min(limit, m_mask + 1);
+            auto tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_headCache >= limit)
+            {
+                m_headCache = m_head.load(std::memory_order_acquire);
+                if (tail - m_headCache >= limit)
+                {
+                    return false;
+                }
+            }
+            m_values[tail & m_mask] = std::move(value);
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Pop a value. Consumer thread only.
+         */
+        bool TryPop(T& value)
+        {
+            auto head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tailCache)
+            {
+                m_tailCache = m_tail.load(std::memory_order_acquire);
+                if (head == m_tailCache)
+                {
+                    return false;
+                }
+            }
+            value = std::move(m_values[head & m_mask]);
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * True when there is nothing for the consumer to pop
+         */
+        bool Empty() const
+        {
+            return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Number of values pushed since the buffer was created. Producer thread only.
+         */
+        std::size_t PushedCount() const
+        {
+            return m_tail.load(std::memory_order_relaxed);
+        }
+
+    private:
+        const std::size_t m_mask;
+        std::unique_ptr<T[]> m_values;
+        alignas(CacheLineSize) std::atomic<std::size_t> m_tail{0};
+        std::size_t m_headCache{0};
+        alignas(CacheLineSize) std::atomic<std::size_t> m_head{0};
+        std::size_t m_tailCache{0};
+    };
+
+    /**
+     * SPSC buffers for one consumer, one per producing thread. Each thread registers its own buffer on first use;
+     * the buffer is reclaimed once its thread has exited and the consumer has drained it.
+     */
+    template <typename T>
+    class ThreadBufferRegistry final
+    {
+    public:
+        explicit ThreadBufferRegistry(std::size_t capacity) : m_capacity(capacity), m_id(NextRegistryId())
+        {
+        }
+
+        ThreadBufferRegistry(ThreadBufferRegistry const& copy) = delete;
+        ThreadBufferRegistry& operator=(ThreadBufferRegistry const& copy) = delete;
+
+        /**
+         * The calling thread's buffer, registered with the consumer on first use
+         */
+        SpscRingBuffer<T>& LocalBuffer()
+        {
+            static thread_local ThreadBufferSet local;
+            for (auto& entry : local.entries)
+            {
+                if (entry.first == m_id)
+                {
+                    return entry.second->buffer;
+                }
+            }
+            auto threadBuffer = std::make_shared<ThreadBuffer>(m_capacity);
+            local.entries.emplace_back(m_id, threadBuffer);
+            {
+                std::lock_guard<std::mutex> lock(m_registrationLock);
+                m_registrations.push_back(threadBuffer);
+                m_hasRegistrations.store(true, std::memory_order_release);
+            }
+            return threadBuffer->buffer;
+        }
+
+        /**
+         * Call drain(buffer, threadId) for every registered buffer. Consumer thread only.
+         */
+        template <typename Drain>
+        void DrainEach(Drain drain)
+        {
+            AdoptRegistrations();
+            for (auto it = m_threadBuffers.begin(); it != m_threadBuffers.end();)
+            {
+                // Read closed first, anything pushed before the thread exited is then guaranteed to be drained
+                bool closed = (*it)->closed.load(std::memory_order_acquire);
+                drain((*it)->buffer, (*it)->threadId);
+                it = closed ? m_threadBuffers.erase(it) : it + 1;
+            }
+        }
+
+        /**
+         * True when no buffer has anything to drain. Consumer thread only.
+         */
+        bool Empty() const
+        {
+            if (m_hasRegistrations.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            for (const auto& threadBuffer : m_threadBuffers)
+            {
+                if (!threadBuffer->buffer.Empty())
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        struct ThreadBuffer
+        {
+            explicit ThreadBuffer(std::size_t capacity) : buffer(capacity)
+            {
+            }
+
+            SpscRingBuffer<T> buffer;
+            const std::uint32_t threadId{CurrentThreadId()};
+            std::atomic<bool> closed{false};
+        };
+
+        /**
+         * The buffers owned by one thread, marked closed when the thread exits.
+         * Keyed by registry id rather than address so a registry created at a recycled address never sees stale
+         * buffers.
+         */
+        struct ThreadBufferSet
+        {
+            ThreadBufferSet() = default;
+            ThreadBufferSet(ThreadBufferSet const& copy) = delete;
+            ThreadBufferSet& operator=(ThreadBufferSet const& copy) = delete;
+
+            ~ThreadBufferSet()
+            {
+                for (auto& entry : entries)
+                {
+                    entry.second->closed.store(true, std::memory_order_release);
+                }
+            }
+
+            std::vector<std::pair<std::uint64_t, std::shared_ptr<ThreadBuffer>>> entries{};
+        };
+
+        static std::uint64_t NextRegistryId()
+        {
+            static std::atomic<std::uint64_t> nextId{1};
+            return nextId.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * Move newly registered thread buffers onto the consumer's list
+         */
+        void AdoptRegistrations()
+        {
+            if (!m_hasRegistrations.load(std::memory_order_acquire))
+            {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(m_registrationLock);
+            m_threadBuffers.insert(m_threadBuffers.end(), m_registrations.begin(), m_registrations.end());
+            m_registrations.clear();
+            m_hasRegistrations.store(false, std::memory_order_relaxed);
+        }
+
+        const std::size_t m_capacity;
+        const std::uint64_t m_id;
+        std::mutex m_registrationLock{};
+        std::vector<std::shared_ptr<ThreadBuffer>> m_registrations{};
+        std::atomic<bool> m_hasRegistrations{false};
+        std::vector<std::shared_ptr<ThreadBuffer>> m_threadBuffers{};
+    };
+
+    /**
+     * The queue feeding one writer thread.
+     * In QueueMode::Shared producers push to a single MPSC ring buffer. In QueueMode::PerThread each producing thread
+     * pushes to its own SPSC buffer from a ThreadBufferRegistry. The writer merges everything it drains by timestamp.
+     * The capacity set at run time limits each ring buffer below its allocated size, what happens to a message
+     * pushed into a full buffer is decided by the OverflowPolicy.
+     */
+    class LogQueue final
+    {
+    public:
+        LogQueue(std::size_t sharedCapacity, std::size_t threadCapacity)
+            : m_shared(sharedCapacity), m_threadBuffers(threadCapacity), m_capacity(m_shared.Capacity())
+        {
+        }
+
+        LogQueue(LogQueue const& copy) = delete;
+        LogQueue& operator=(LogQueue const& copy) = delete;
+
+        void SetQueueMode(const QueueMode& mode)
+        {
+            m_perThread.store(mode == QueueMode::PerThread, std::memory_order_relaxed);
+        }
+
+        /**
+         * Allocate the shared ring buffer. Call before the first Push(), when the queue's writer is started.
+         */
+        void Allocate()
+        {
+            m_shared.Allocate();
+        }
+
+        /**
+         * Limit how many records each ring buffer holds, at least one and at most its allocated size
+         */
+        void SetCapacity(std::size_t records)
+        {
+            m_capacity.store(std::max<std::size_t>(records, 1), std::memory_order_relaxed);
+        }
+
+        void SetOverflowPolicy(const OverflowPolicy& policy)
+        {
+            m_policy.store(policy, std::memory_order_relaxed);
+        }
+
+        /**
+         * Number of records discarded by the overflow policy since the queue was created
+         */
+        std::uint64_t DroppedCount() const
+        {
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Fill in the queue's share of the stats for its output
+         */
+        void CollectStats(SinkStats& stats) const
+        {
+            auto dequeued = m_dequeued.load(std::memory_order_relaxed);
+            auto evicted = m_evicted.load(std::memory_order_relaxed);
+            stats.enqueued = m_enqueued.Load();
+            stats.dropped = DroppedCount();
+            // The counters are read one after another, clamp any transient skew
+            stats.queueDepth = stats.enqueued > dequeued + evicted ? stats.enqueued - dequeued - evicted : 0;
+            stats.queueHighWater = m_highWater.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Queue a record and wake the writer. When the producer's queue is full the overflow policy decides whether
+         * to wait for room or discard a record.
+         */
+        void Push(QueuedRecord&& record)
+        {
+            auto capacity = m_capacity.load(std::memory_order_relaxed);
+            auto policy = m_policy.load(std::memory_order_relaxed);
+            if (m_perThread.load(std::memory_order_relaxed))
+            {
+                auto& buffer = m_threadBuffers.LocalBuffer();
+                while (!buffer.TryPush(std::move(record), capacity))
+                {
+                    if (policy == OverflowPolicy::DropOldest || Discard(record, policy))
+                    {
+                        m_dropped.fetch_add(1, std::memory_order_relaxed);
+                        m_signal->Notify();
+                        return;
+                    }
+                    m_signal->Notify();
+                    std::this_thread::yield();
+                }
+            }
+            else
+            {
+                while (!m_shared.TryPush(std::move(record), capacity))
+                {
+                    QueuedRecord oldest{};
+                    if (policy == OverflowPolicy::DropOldest)
+                    {
+                        // Another producer may take the freed slot first, then evict again
+                        if (m_shared.TryPop(oldest))
+                        {
+                            m_dropped.fetch_add(1, std::memory_order_relaxed);
+                            m_evicted.fetch_add(1, std::memory_order_relaxed);
+                        }
+                        continue;
+                    }
+                    if (Discard(record, policy))
+                    {
+                        m_dropped.fetch_add(1, std::memory_order_relaxed);
+                        m_signal->Notify();
+                        return;
+                    }
+                    m_signal->Notify();
+                    std::this_thread::yield();
+                }
+            }
+            m_enqueued.Increment();
+            m_signal->Notify();
+        }
+
+        /**
+         * Move everything currently queued onto the end of batch, ordered by timestamp. Writer thread only.
+         */
+        bool Drain(std::vector<QueuedRecord>& batch)
+        {
+            auto initialSize = batch.size();
+            QueuedRecord record{};
+            std::size_t sources = 0;
+            std::size_t count = 0;
+            while (count < m_shared.Capacity() && m_shared.TryPop(record))
+            {
+                batch.push_back(std::move(record));
+                ++count;
+            }
+            sources += count > 0 ? 1 : 0;
+
+            m_threadBuffers.DrainEach([&](SpscRingBuffer<QueuedRecord>& buffer, std::uint32_t) {
+                count = 0;
+                while (buffer.TryPop(record))
+                {
+                    batch.push_back(std::move(record));
+                    ++count;
+                }
+                sources += count > 0 ? 1 : 0;
+            });
+
+            if (sources > 1)
+            {
+                std::stable_sort(batch.begin(), batch.end(), [](const QueuedRecord& a, const QueuedRecord& b) {
+                    return a.Get().timestamp < b.Get().timestamp;
+                });
+            }
+
+            auto drained = static_cast<std::uint64_t>(batch.size() - initialSize);
+            m_dequeued.store(m_dequeued.load(std::memory_order_relaxed) + drained, std::memory_order_relaxed);
+            if (drained > m_highWater.load(std::memory_order_relaxed))
+            {
+                m_highWater.store(drained, std::memory_order_relaxed);
+            }
+            return !batch.empty();
+        }
+
+        /**
+         * True when there is nothing to drain. Writer thread only.
+         */
+        bool Empty() const
+        {
+            return m_shared.Empty() && m_threadBuffers.Empty();
+        }
+
+        /**
+         * How far producers have got. Once Reached() the position, every record pushed before Position() was called
+         * has been drained or evicted: the shared buffer is checked by count, and the next Drain() empties the per
+         * thread buffers. Writer thread only.
+         */
+        std::size_t Position() const
+        {
+            return m_shared.PushedCount();
+        }
+
+        bool Reached(std::size_t position) const
+        {
+            return m_shared.PoppedCount() >= position;
+        }
+
+        /**
+         * Wake signal of a writer serving several queues in place of this queue's own. Set it before any record is
+         * pushed.
+         */
+        void ShareSignal(WriterSignal& signal)
+        {
+            m_signal = &signal;
+        }
+
+        void Notify()
+        {
+            m_signal->Notify();
+        }
+
+        template <typename Predicate>
+        void Wait(Predicate ready, const WriterWakeup& wakeup)
+        {
+            m_signal->Wait(ready, wakeup);
+        }
+
+        template <typename Predicate>
+        void WaitFor(Predicate ready, std::chrono::nanoseconds timeout, const WriterWakeup& wakeup)
+        {
+            m_signal->WaitFor(ready, timeout, wakeup);
+        }
+
+    private:
+        /**
+         * True if the overflow policy discards record rather than waiting for room
+         */
+        static bool Discard(const QueuedRecord& record, OverflowPolicy policy)
+        {
+            return policy == OverflowPolicy::DropNewest ||
+                   (policy == OverflowPolicy::DropBelowLevel && record.Get().level < LogLevel::L_WARNING);
+        }
+
+        MpscRingBuffer<QueuedRecord> m_shared;
+        ThreadBufferRegistry<QueuedRecord> m_threadBuffers;
+        std::atomic<bool> m_perThread{false};
+        std::atomic<std::size_t> m_capacity;
+        std::atomic<OverflowPolicy> m_policy{OverflowPolicy::Block};
+        std::atomic<std::uint64_t> m_dropped{0};
+        std::atomic<std::uint64_t> m_evicted{0};
+        StripedCounter m_enqueued{};
+        std::atomic<std::uint64_t> m_dequeued{0};
+        std::atomic<std::uint64_t> m_highWater{0};
+        WriterSignal m_ownSignal{};
+        WriterSignal* m_signal{&m_ownSignal};
+    };
+
+    /**
+     * Log file written through a memory mapping.
+     * The file grows a segment at a time: each segment is preallocated with fallocate and mapped, so writing a
+     * message is a memcpy with no syscall. Close() trims the unused tail of the last segment. Until then readers
+     * of the file see the preallocated remainder of the current segment as zero bytes.
+     */
+    class MappedFile final
+    {
+    public:
+        MappedFile() = default;
+        MappedFile(MappedFile const& copy) = delete;
+        MappedFile& operator=(MappedFile const& copy) = delete;
+
+        ~MappedFile()
+        {
+            Close();
+        }
+
+        /**
+         * Create or truncate filePath and map its first segment, returns false if the file cannot be mapped
+         */
+        bool Open(const std::string& filePath, std::size_t segmentSize)
+        {
+            Close();
+#ifndef WIN32
+            m_fd = ::open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (m_fd < 0)
+            {
+                return false;
+            }
+            auto pageSize = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+            m_segmentSize = (segmentSize + pageSize - 1) / pageSize * pageSize;
+            if (!MapSegment(0))
+            {
+                ::close(m_fd);
+                m_fd = -1;
+                return false;
+            }
+            return true;
+#else
+            (void)filePath;
+            (void)segmentSize;
+            return false;
+#endif
+        }
+
+        bool IsOpen() const
+        {
+            return m_map != nullptr;
+        }
+
+        /**
+         * Copy data into the mapping, moving on to the next segment whenever the current one fills
+         */
+        void Write(const char* data, std::size_t size)
+        {
+            while (size > 0 && m_map != nullptr)
+            {
+                if (m_used == m_segmentSize && !MapSegment(m_segmentOffset + m_segmentSize))
+                {
+                    return;
+                }
+                auto chunk = std::min(size, m_segmentSize - m_used);
+                std::memcpy(m_map + m_used, data, chunk);
+                m_used += chunk;
+                data += chunk;
+                size -= chunk;
+            }
+        }
+
+        /**
+         * Unmap and trim the file to the bytes actually written
+         */
+        void Close()
+        {
+#ifndef WIN32
+            if (m_fd < 0)
+            {
+                return;
+            }
+            auto length = m_segmentOffset + m_used;
+            Unmap();
+            if (::ftruncate(m_fd, static_cast<off_t>(length)) != 0)
+            {
+                // Nothing better to do, the tail of the file stays zero filled
+            }
+            ::close(m_fd);
+            m_fd = -1;
+            m_segmentOffset = 0;
+            m_used = 0;
+#endif
+        }
+
+    private:
+        /**
+         * Preallocate and map the segment starting at offset, replacing the current mapping
+         */
+        bool MapSegment(std::size_t offset)
+        {
+#ifndef WIN32
+            Unmap();
+            auto length = static_cast<off_t>(offset + m_segmentSize);
+#ifdef __linux__
+            // Reserve the blocks so a full disk fails here rather than as SIGBUS when the mapping is written.
+            // Filesystems without fallocate support just get a sparse extension.
+            if (::fallocate(m_fd, 0, static_cast<off_t>(offset), static_cast<off_t>(m_segmentSize)) != 0 &&
+                (errno != EOPNOTSUPP || ::ftruncate(m_fd, length) != 0))
+            {
+                return false;
+            }
+#else
+            if (::ftruncate(m_fd, length) != 0)
+            {
+                return false;
+            }
+#endif
+            void* map = ::mmap(nullptr, m_segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd,
+                               static_cast<off_t>(offset));
+            if (map == MAP_FAILED)
+            {
+                return false;
+            }
+            m_map = static_cast<char*>(map);
+            m_segmentOffset = offset;
+            m_used = 0;
+            return true;
+#else
+            (void)offset;
+            return false;
+#endif
+        }
+
+        void Unmap()
+        {
+#ifndef WIN32
+            if (m_map != nullptr)
+            {
+                ::munmap(m_map, m_segmentSize);
+                m_map = nullptr;
+                m_segmentOffset += m_used;
+                m_used = 0;
+            }
+#endif
+        }
+
+        int m_fd{-1};
+        char* m_map{nullptr};
+        std::size_t m_segmentSize{0};
+        std::size_t m_segmentOffset{0};
+        std::size_t m_used{0};
+    };
+
+    /**
+     * Log file written through io_uring.
+     * Each Write() copies the batch into a free buffer and submits it at the next file offset without waiting,
+     * so up to LoggerUringBufferCount writes are in flight and a slow disk only stalls the writer once all of them
+     * are. Buffers are recycled as their completions are reaped, and an fdatasync is submitted at most once per
+     * LoggerUringSyncInterval. Uses the raw system calls, liburing is not needed.
+     * A write that fails is counted and written again with pwrite(), which is used for every write after it, so
+     * the file gets no holes.
+     */
+    class UringFile final
+    {
+    public:
+        UringFile() = default;
+        UringFile(UringFile const& copy) = delete;
+        UringFile& operator=(UringFile const& copy) = delete;
+
+        ~UringFile()
+        {
+            Close();
+        }
+
+        /**
+         * Create or truncate filePath and set up the ring, returns false if io_uring is unavailable
+         */
+        bool Open(const std::string& filePath)
+        {
+            Close();
+#if SINGLELOG_IO_URING
+            io_uring_params params{};
+            m_ring = static_cast<int>(::syscall(__NR_io_uring_setup, LoggerUringBufferCount * 2, &params));
+            if (m_ring < 0 || !SupportsWrite() || !MapRing(params))
+            {
+                Close();
+                return false;
+            }
+            m_fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (m_fd < 0)
+            {
+                Close();
+                return false;
+            }
+            m_buffers.resize(LoggerUringBufferCount);
+            for (auto& buffer : m_buffers)
+            {
+                buffer.data.reset(new char[LoggerUringBufferSize]);
+            }
+            m_lastSync = std::chrono::steady_clock::now();
+            return true;
+#else
+            (void)filePath;
+            return false;
+#endif
+        }
+
+        bool IsOpen() const
+        {
+            return m_fd >= 0;
+        }
+
+        /**
+         * Writes that failed since the last call
+         */
+        std::uint64_t TakeWriteErrors()
+        {
+            auto errors = m_writeErrors;
+            m_writeErrors = 0;
+            return errors;
+        }
+
+        /**
+         * Copy data into free buffers and submit them, only waiting if every buffer is still in flight
+         */
+        void Write(const char* data, std::size_t size)
+        {
+#if SINGLELOG_IO_URING
+            if (m_synchronous && IsOpen())
+            {
+                if (!WriteAt(data, size, m_offset))
+                {
+                    ++m_writeErrors;
+                }
+                m_offset += size;
+                size = 0;
+            }
+            while (size > 0 && IsOpen())
+            {
+                auto index = FreeBuffer();
+                auto& buffer = m_buffers[index];
+                auto chunk = std::min(size, LoggerUringBufferSize);
+                std::memcpy(buffer.data.get(), data, chunk);
+                buffer.offset = m_offset;
+                buffer.length = chunk;
+                buffer.written = 0;
+                buffer.stalls = 0;
+                buffer.inFlight = true;
+                SubmitWrite(index);
+                m_offset += chunk;
+                data += chunk;
+                size -= chunk;
+            }
+            if (IsOpen() && !m_syncInFlight && std::chrono::steady_clock::now() - m_lastSync >= LoggerUringSyncInterval)
+            {
+                if (m_synchronous)
+                {
+                    ::fdatasync(m_fd);
+                    m_lastSync = std::chrono::steady_clock::now();
+                    return;
+                }
+                io_uring_sqe* sqe = NextSqe();
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fd = m_fd;
+                sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+                sqe->user_data = SyncTag;
+                Submit();
+                m_syncInFlight = true;
+                m_lastSync = std::chrono::steady_clock::now();
+            }
+#else
+            (void)data;
+            (void)size;
+#endif
+        }
+
+        /**
+         * Wait until every submitted write has completed
+         */
+        void Wait()
+        {
+#if SINGLELOG_IO_URING
+            while (IsOpen() && std::any_of(m_buffers.begin(), m_buffers.end(),
+                                           [](const Buffer& buffer) { return buffer.inFlight; }))
+            {
+                Reap(true);
+            }
+#endif
+        }
+
+        /**
+         * Wait for outstanding writes, then close the file and the ring
+         */
+        void Close()
+        {
+#if SINGLELOG_IO_URING
+            Wait();
+            while (m_fd >= 0 && m_syncInFlight)
+            {
+                Reap(true);
+            }
+            if (m_fd >= 0)
+            {
+                ::close(m_fd);
+                m_fd = -1;
+            }
+            if (m_sqRing != nullptr)
+            {
+                ::munmap(m_sqRing, m_sqRingSize);
+            }
+            if (m_cqRing != nullptr && m_cqRing != m_sqRing)
+            {
+                ::munmap(m_cqRing, m_cqRingSize);
+            }
+            if (m_sqes != nullptr)
+            {
+                ::munmap(m_sqes, m_sqesSize);
+            }
+            if (m_ring >= 0)
+            {
+                ::close(m_ring);
+            }
+            m_ring = -1;
+            m_sqRing = nullptr;
+            m_cqRing = nullptr;
+            m_sqes = nullptr;
+            m_buffers.clear();
+            m_offset = 0;
+            m_syncInFlight = false;
+            m_synchronous = false;
+#endif
+        }
+
+    private:
+        struct Buffer
+        {
+            std::unique_ptr<char[]> data{};
+            std::size_t offset{0};
+            std::size_t length{0};
+            std::size_t written{0};
+            unsigned stalls{0};
+            bool inFlight{false};
+        };
+
+#if SINGLELOG_IO_URING
+        static constexpr std::uint64_t SyncTag = ~std::uint64_t{0};
+        static constexpr unsigned MaxWriteStalls = 3;
+
+        /**
+         * Whether the kernel has IORING_OP_WRITE, which io_uring only gained in 5.6 like the probe itself
+         */
+        bool SupportsWrite() const
+        {
+            constexpr unsigned probeOps = 256;
+            std::vector<std::uint64_t> storage(
+                (sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op) + sizeof(std::uint64_t) - 1) /
+                sizeof(std::uint64_t));
+            auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+            if (::syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_PROBE, probe, probeOps) < 0)
+            {
+                return false;
+            }
+            return IORING_OP_WRITE < probe->ops_len && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED) != 0;
+        }
+
+        /**
+         * Write all of data at offset without io_uring, false if the file refuses it
+         */
+        bool WriteAt(const char* data, std::size_t size, std::size_t offset)
+        {
+            while (size > 0)
+            {
+                auto written = ::pwrite(m_fd, data, size, static_cast<off_t>(offset));
+                if (written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (written <= 0)
+                {
+                    return false;
+                }
+                data += written;
+                size -= static_cast<std::size_t>(written);
+                offset += static_cast<std::size_t>(written);
+            }
+            return true;
+        }
+
+        static unsigned* RingField(void* ring, std::uint32_t offset)
+        {
+            return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+        }
+
+        bool MapRing(const io_uring_params& params)
+        {
+            m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+            {
+                m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+            }
+            void* sqRing = ::mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring,
+                                  static_cast<off_t>(IORING_OFF_SQ_RING));
+            if (sqRing == MAP_FAILED)
+            {
+                return false;
+            }
+            m_sqRing = sqRing;
+            m_cqRing = sqRing;
+            if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0)
+            {
+                void* cqRing = ::mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                      m_ring, static_cast<off_t>(IORING_OFF_CQ_RING));
+                if (cqRing == MAP_FAILED)
+                {
+                    m_cqRing = nullptr;
+                    return false;
+                }
+                m_cqRing = cqRing;
+            }
+            m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            void* sqes = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring,
+                                static_cast<off_t>(IORING_OFF_SQES));
+            if (sqes == MAP_FAILED)
+            {
+                return false;
+            }
+            m_sqes = static_cast<io_uring_sqe*>(sqes);
+            m_sqTail = RingField(m_sqRing, params.sq_off.tail);
+            m_sqMask = *RingField(m_sqRing, params.sq_off.ring_mask);
+            m_sqArray = RingField(m_sqRing, params.sq_off.array);
+            m_cqHead = RingField(m_cqRing, params.cq_off.head);
+            m_cqTail = RingField(m_cqRing, params.cq_off.tail);
+            m_cqMask = *RingField(m_cqRing, params.cq_off.ring_mask);
+            m_cqes = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(m_cqRing) + params.cq_off.cqes);
+            return true;
+        }
+
+        /**
+         * The next submission queue entry, cleared, for the caller to fill in before Submit(). At most every
+         * buffer and one fdatasync are in flight, which the ring was sized for, so there is always one free.
+         */
+        io_uring_sqe* NextSqe()
+        {
+            auto index = *m_sqTail & m_sqMask;
+            io_uring_sqe* sqe = &m_sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            m_sqArray[index] = index;
+            return sqe;
+        }
+
+        /**
+         * Publish the entry from NextSqe() once it is filled in, then hand it to the kernel
+         */
+        void Submit()
+        {
+            __atomic_store_n(m_sqTail, *m_sqTail + 1, __ATOMIC_RELEASE);
+            Enter(1, 0);
+        }
+
+        void Enter(unsigned submit, unsigned wait)
+        {
+            while (::syscall(__NR_io_uring_enter, m_ring, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0,
+                             nullptr, 0) < 0 &&
+                   errno == EINTR)
+            {
+                // Submitted entries are consumed by the kernel even when the wait is interrupted
+                submit = 0;
+            }
+        }
+
+        void SubmitWrite(std::size_t index)
+        {
+            auto& buffer = m_buffers[index];
+            io_uring_sqe* sqe = NextSqe();
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = m_fd;
+            sqe->off = buffer.offset + buffer.written;
+            sqe->addr = reinterpret_cast<std::uint64_t>(buffer.data.get() + buffer.written);
+            sqe->len = static_cast<std::uint32_t>(buffer.length - buffer.written);
+            sqe->user_data = index;
+            Submit();
+        }
+
+        /**
+         * Handle completed requests, first waiting for at least one if wait is set. Short and interrupted writes
+         * are submitted again for the rest. A failed write, or one that keeps writing nothing, is counted and its
+         * buffer written with pwrite(), which the file then keeps to.
+         */
+        void Reap(bool wait)
+        {
+            if (wait)
+            {
+                Enter(0, 1);
+            }
+            auto head = *m_cqHead;
+            while (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+            {
+                const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+                if (cqe.user_data == SyncTag)
+                {
+                    m_syncInFlight = false;
+                }
+                else
+                {
+                    auto& buffer = m_buffers[static_cast<std::size_t>(cqe.user_data)];
+                    if (cqe.res > 0)
+                    {
+                        buffer.written += static_cast<std::size_t>(cqe.res);
+                        buffer.stalls = 0;
+                    }
+                    bool retry = cqe.res > 0 || cqe.res == -EINTR || cqe.res == -EAGAIN ||
+                                 (cqe.res == 0 && ++buffer.stalls < MaxWriteStalls);
+                    if (retry && buffer.written < buffer.length)
+                    {
+                        SubmitWrite(static_cast<std::size_t>(cqe.user_data));
+                    }
+                    else
+                    {
+                        if (buffer.written < buffer.length)
+                        {
+                            ++m_writeErrors;
+                            m_synchronous = true;
+                            if (!WriteAt(buffer.data.get() + buffer.written, buffer.length - buffer.written,
+                                         buffer.offset + buffer.written))
+                            {
+                                ++m_writeErrors;
+                            }
+                        }
+                        buffer.inFlight = false;
+                    }
+                }
+                __atomic_store_n(m_cqHead, ++head, __ATOMIC_RELEASE);
+            }
+        }
+
+        /**
+         * Index of a buffer that is not in flight, waiting for a completion if there is none
+         */
+        std::size_t FreeBuffer()
+        {
+            Reap(false);
+            while (true)
+            {
+                for (std::size_t i = 0; i < m_buffers.size(); ++i)
+                {
+                    if (!m_buffers[i].inFlight)
+                    {
+                        return i;
+                    }
+                }
+                Reap(true);
+            }
+        }
+
+        void* m_sqRing{nullptr};
+        void* m_cqRing{nullptr};
+        io_uring_sqe* m_sqes{nullptr};
+        io_uring_cqe* m_cqes{nullptr};
+        unsigned* m_sqTail{nullptr};
+        unsigned* m_sqArray{nullptr};
+        unsigned* m_cqHead{nullptr};
+        unsigned* m_cqTail{nullptr};
+        unsigned m_sqMask{0};
+        unsigned m_cqMask{0};
+        std::size_t m_sqRingSize{0};
+        std::size_t m_cqRingSize{0};
+        std::size_t m_sqesSize{0};
+#endif
+
+        int m_ring{-1};
+        int m_fd{-1};
+        std::vector<Buffer> m_buffers{};
+        std::size_t m_offset{0};
+        bool m_syncInFlight{false};
+        bool m_synchronous{false};
+        std::uint64_t m_writeErrors{0};
+        std::chrono::steady_clock::time_point m_lastSync{};
+    };
+
+    /**
+     * State for one call site of the rate limiting macros, held in a static there.
+     * Each check returns true for a call that is let through. A call that is held back only updates counters,
+     * and for the time based checks reads the clock, nothing is formatted.
+     */
+    class CallSiteLimiter final
+    {
+    public:
+        /**
+         * Let through the 1st, n+1th, 2n+1th... call. The calls in between are not counted as suppressed, there are
+         * always n - 1 of them.
+         */
+        bool EveryN(std::uint64_t n)
+        {
+            return m_count.fetch_add(1, std::memory_order_relaxed) % std::max<std::uint64_t>(n, 1) == 0;
+        }
+
+        /**
+         * Let through the first n calls. Later calls are not counted as suppressed, as no call after them would
+         * report the count.
+         */
+        bool FirstN(std::uint64_t n)
+        {
+            // Stop counting once past n so the counter cannot wrap around
+            return m_count.load(std::memory_order_relaxed) < n && m_count.fetch_add(1, std::memory_order_relaxed) < n;
+        }
+
+        /**
+         * Let through at most one call per interval
+         */
+        bool EveryMs(std::uint64_t milliseconds)
+        {
+            auto now = SteadyNanos();
+            auto last = m_time.load(std::memory_order_relaxed);
+            if ((last != 0 && now - last < static_cast<std::int64_t>(milliseconds) * 1000000) ||
+                !m_time.compare_exchange_strong(last, now, std::memory_order_relaxed))
+            {
+                m_suppressed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * Token bucket holding burst tokens and refilled at perSecond, kept as the time the bucket will be full
+         * again (the generic cell rate algorithm) so it is a single atomic
+         */
+        bool RateLimited(double perSecond, std::uint64_t burst)
+        {
+            auto interval = static_cast<std::int64_t>(1e9 / std::max(perSecond, 1e-9));
+            auto tolerance = interval * static_cast<std::int64_t>(std::max<std::uint64_t>(burst, 1) - 1);
+            auto now = SteadyNanos();
+            auto full = m_time.load(std::memory_order_relaxed);
+            std::int64_t next = 0;
+            do
+            {
+                next = std::max(full, now);
+                if (next - now > tolerance)
+                {
+                    m_suppressed.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            } while (!m_time.compare_exchange_weak(full, next + interval, std::memory_order_relaxed));
+            return true;
+        }
+
+        /**
+         * Number of calls held back by EveryMs() or RateLimited() since the last call, resetting it to zero
+         */
+        std::uint64_t TakeSuppressed()
+        {
+            return m_suppressed.load(std::memory_order_relaxed) == 0
+                       ? 0
+                       : m_suppressed.exchange(0, std::memory_order_relaxed);
+        }
+
+    private:
+        static std::int64_t SteadyNanos()
+        {
+            return static_cast<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                 std::chrono::steady_clock::now().time_since_epoch())
+                                                 .count());
+        }
+
+        std::atomic<std::uint64_t> m_count{0};
+        std::atomic<std::int64_t> m_time{0};
+        std::atomic<std::uint64_t> m_suppressed{0};
+    };
+
+    /**
+     * Where a LOG_FUNCTION_TRACE scope is, one static instance per call site
+     */
+    struct TraceSite
+    {
+        const char* function;
+        const char* file;
+        int line;
+    };
+
+    /**
+     * One completed LOG_FUNCTION_TRACE scope, in Clock::Now() ticks
+     */
+    struct TraceSpan
+    {
+        const TraceSite* site{nullptr};
+        std::uint64_t begin{0};
+        std::uint64_t end{0};
+    };
+
+    /**
+     * Records LOG_FUNCTION_TRACE scopes into per-thread buffers and writes them to a Chrome trace event file, the
+     * JSON array format opened by chrome://tracing and https://ui.perfetto.dev.
+     * Recording a scope takes two Clock::Now() reads and a push into the calling thread's own ring buffer. A scope
+     * that finds its buffer full is counted and dropped rather than waiting for the writer.
+     */
+    class TraceRecorder final
+    {
+    public:
+        TraceRecorder() = default;
+        TraceRecorder(TraceRecorder const& copy) = delete;
+        TraceRecorder& operator=(TraceRecorder const& copy) = delete;
+
+        ~TraceRecorder()
+        {
+            Stop();
+        }
+
+        bool IsActive() const
+        {
+            return m_active.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Start writing a new trace to filePath, finishing any trace in progress. Returns false if the file cannot
+         * be created.
+         */
+        bool Start(const std::string& filePath)
+        {
+            std::lock_guard<std::mutex> lock(m_controlLock);
+            StopWriter();
+            m_file.open(filePath, std::ios_base::out | std::ios_base::trunc);
+            if (!m_file.is_open())
+            {
+                return false;
+            }
+            m_startTick = Clock::Now();
+            m_exit.store(false);
+            m_writer = std::thread(&TraceRecorder::Writer, this);
+            m_active.store(true, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Call configure(thread) with the writer thread, if it is running
+         */
+        template <typename Configure>
+        void ConfigureWriter(Configure configure)
+        {
+            std::lock_guard<std::mutex> lock(m_controlLock);
+            if (m_writer.joinable())
+            {
+                configure(m_writer);
+            }
+        }
+
+        /**
+         * Write out everything recorded so far and close the trace file
+         */
+        void Stop()
+        {
+            std::lock_guard<std::mutex> lock(m_controlLock);
+            StopWriter();
+        }
+
+        /**
+         * Queue a finished scope. The writer is woken every quarter buffer so a busy thread never waits for the
+         * flush interval to free room.
+         */
+        void Record(const TraceSite& site, std::uint64_t begin, std::uint64_t end)
+        {
+            auto& buffer = m_buffers.LocalBuffer();
+            TraceSpan span{&site, begin, end};
+            if (!buffer.TryPush(std::move(span), LoggerTraceBufferCapacity))
+            {
+                // The writer has already been woken for this buffer, dropping has to stay as cheap as recording
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            if (buffer.PushedCount() % (LoggerTraceBufferCapacity / 4) == 0)
+            {
+                m_signal.Notify();
+            }
+        }
+
+        /**
+         * Scopes written to trace files so far
+         */
+        std::uint64_t WrittenCount() const
+        {
+            return m_written.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Scopes dropped because their thread's buffer was full
+         */
+        std::uint64_t DroppedCount() const
+        {
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+
+    private:
+        /**
+         * Stop and join the writer, then terminate the JSON array. Call with m_controlLock.
+         */
+        void StopWriter()
+        {
+            m_active.store(false, std::memory_order_relaxed);
+            if (m_writer.joinable())
+            {
+                m_exit.store(true);
+                m_signal.Notify();
+                m_writer.join();
+            }
+            if (m_file.is_open())
+            {
+                m_file << "\n]\n";
+                m_file.close();
+            }
+        }
+
+        /**
+         * Writer thread loop: drain every thread's buffer at least once per LoggerTraceFlushInterval.
+         * Each event is written as a line of its own, so a trace cut short by a crash loses at most the last line
+         * and the closing bracket, which the trace viewers do not require.
+         */
+        void Writer()
+        {
+            Clock clock;
+            clock.Calibrate();
+            std::string pending = "[\n";
+            AppendStart(clock, pending);
+            std::unordered_map<const TraceSite*, std::pair<std::string, std::string>> sites;
+            while (true)
+            {
+                bool exit = m_exit.load();
+                clock.Calibrate();
+                std::uint64_t written = 0;
+                m_buffers.DrainEach([&](SpscRingBuffer<TraceSpan>& buffer, std::uint32_t threadId) {
+                    TraceSpan span{};
+                    while (buffer.TryPop(span))
+                    {
+                        // Scopes that began before this trace was started belong to no trace file
+                        if (static_cast<std::int64_t>(span.begin - m_startTick) >= 0)
+                        {
+                            AppendSpan(clock, span, threadId, sites, pending);
+                            ++written;
+                        }
+                    }
+                });
+                if (!pending.empty())
+                {
+                    m_file.write(pending.data(), static_cast<std::streamsize>(pending.size()));
+                    m_file.flush();
+                    pending.clear();
+                }
+                m_written.store(m_written.load(std::memory_order_relaxed) + written, std::memory_order_relaxed);
+                if (exit)
+                {
+                    break;
+                }
+                m_signal.WaitFor([this]() { return m_exit.load() || !m_buffers.Empty(); }, LoggerTraceFlushInterval);
+            }
+        }
+
+        /**
+         * An instant event at time zero carrying the wall clock time the trace started
+         */
+        void AppendStart(const Clock& clock, std::string& out)
+        {
+            TimestampFormatter formatter;
+            std::string time;
+            formatter.AppendWallTime(clock.ToWallNanos(m_startTick), TimestampPrecision::Nanoseconds, time);
+            out += "{\"name\":\"trace start\",\"ph\":\"i\",\"s\":\"g\",\"ts\":0,\"pid\":";
+            AppendUnsigned(CurrentProcessId(), out);
+            out += ",\"tid\":0,\"args\":{\"time\":";
+            AppendJsonString(out, time.data(), time.size());
+            out += "}}";
+        }
+
+        /**
+         * A complete ("X") event. Times are microseconds since the trace started, keeping nanosecond digits
+         * that absolute times would lose to the viewers' double precision parsing. The escaped text for each call
+         * site is built once and kept in sites.
+         */
+        void AppendSpan(const Clock& clock, const TraceSpan& span, std::uint32_t threadId,
+                        std::unordered_map<const TraceSite*, std::pair<std::string, std::string>>& sites,
+                        std::string& out)
+        {
+            auto& site = sites[span.site];
+            if (site.first.empty())
+            {
+                site.first = ",\n{\"name\":";
+                AppendJsonString(site.first, span.site->function, std::strlen(span.site->function));
+                site.first += ",\"cat\":\"function\",\"ph\":\"X\",\"pid\":";
+                AppendUnsigned(CurrentProcessId(), site.first);
+                site.first += ",\"ts\":";
+                site.second = ",\"args\":{\"file\":";
+                AppendJsonString(site.second, span.site->file, std::strlen(span.site->file));
+                site.second += ",\"line\":";
+                AppendUnsigned(static_cast<std::uint64_t>(span.site->line), site.second);
+                site.second += "}}";
+            }
+            auto begin = clock.ToWallNanos(span.begin);
+            out += site.first;
+            AppendMicros(begin - clock.ToWallNanos(m_startTick), out);
+            out += ",\"dur\":";
+            AppendMicros(clock.ToWallNanos(span.end) - begin, out);
+            out += ",\"tid\":";
+            AppendUnsigned(threadId, out);
+            out += site.second;
+        }
+
+        static void AppendUnsigned(std::uint64_t value, std::string& out)
+        {
+            char digits[20];
+            std::size_t count = 0;
+            do
+            {
+                digits[count++] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            } while (value != 0);
+            while (count > 0)
+            {
+                out += digits[--count];
+            }
+        }
+
+        static void AppendMicros(std::int64_t nanos, std::string& out)
+        {
+            auto value = static_cast<std::uint64_t>(std::max<std::int64_t>(nanos, 0));
+            AppendUnsigned(value / 1000, out);
+            auto fraction = value % 1000;
+            out += '.';
+            out += static_cast<char>('0' + fraction / 100);
+            out += static_cast<char>('0' + fraction / 10 % 10);
+            out += static_cast<char>('0' + fraction % 10);
+        }
+
+        ThreadBufferRegistry<TraceSpan> m_buffers{LoggerTraceBufferCapacity};
+        std::atomic<bool> m_active{false};
+        std::atomic<bool> m_exit{false};
+        std::atomic<std::uint64_t> m_written{0};
+        std::atomic<std::uint64_t> m_dropped{0};
+        std::uint64_t m_startTick{0};
+        WriterSignal m_signal{};
+        std::mutex m_controlLock{};
+        std::ofstream m_file{};
+        std::thread m_writer{};
+    };
+
+    /**
+     * Base class for user defined outputs, see SingleLog::AddSink()
+     */
+    class LogSink
+    {
+    public:
+        LogSink() = default;
+        LogSink(LogSink const& copy) = delete;
+        LogSink& operator=(LogSink const& copy) = delete;
+        virtual ~LogSink() = default;
+
+        /**
+         * Write formatted log lines, each ending in a newline. Messages are batched, so one call may hold many.
+         * Only ever called from the sink's own writer thread.
+         */
+        virtual void Write(const std::string& lines) = 0;
+    };
+
+    /**
+     * One FlushAsync() call, complete once every writer it was handed to has written what was queued before it
+     */
+    struct FlushRequest
+    {
+        void Release()
+        {
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                done.set_value();
+            }
+        }
+
+        std::atomic<std::size_t> remaining{1};
+        std::promise<void> done{};
+    };
+
+    /**
+     * Keeps the latest records that no output took in memory, up to a fixed number per logging thread, so what led
+     * up to an error can be written out after it. Each thread owns a ring of fixed size slots and keeping a record
+     * copies its encoded payload into the next slot, the captured arguments for LOGF_* and LOG_*_KV or the message
+     * text, cut to fit. A slot is handed between its thread and a dump by one atomic state, no lock is taken.
+     */
+    class FlightRecorder final
+    {
+    public:
+        FlightRecorder() : m_id(NextRecorderId())
+        {
+        }
+
+        FlightRecorder(FlightRecorder const& copy) = delete;
+        FlightRecorder& operator=(FlightRecorder const& copy) = delete;
+
+        /**
+         * Limit how many records each thread keeps, at least one. A thread replaces its ring the next time it
+         * keeps a record, what the old ring holds is still dumped.
+         */
+        void SetCapacity(std::size_t records)
+        {
+            m_capacity.store(std::max<std::size_t>(records, 1), std::memory_order_relaxed);
+        }
+
+        /**
+         * Copy a record into the calling thread's ring, replacing its oldest once the ring is full. The record is
+         * dropped if a dump is reading that slot.
+         */
+        void Record(const LogRecord& record)
+        {
+            auto& ring = LocalRing();
+            auto& slot = ring.slots[ring.next];
+            auto state = slot.state.load(std::memory_order_relaxed);
+            if (state == SlotReading ||
+                !slot.state.compare_exchange_strong(state, SlotWriting, std::memory_order_acquire))
+            {
+                return;
+            }
+            Encode(record, slot);
+            slot.state.store(SlotFull, std::memory_order_release);
+            ring.next = (ring.next + 1) % ring.size;
+        }
+
+        /**
+         * Move every thread's records onto the end of out, emptying the rings, ordered by timestamp
+         */
+        void Collect(std::vector<LogRecord>& out)
+        {
+            auto initialSize = out.size();
+            std::lock_guard<std::mutex> lock(m_lock);
+            for (auto it = m_rings.begin(); it != m_rings.end();)
+            {
+                auto& ring = **it;
+                // Read closed first, a ring is not written again once it is set
+                bool closed = ring.closed.load(std::memory_order_acquire);
+                for (std::size_t i = 0; i < ring.size; ++i)
+                {
+                    auto& slot = ring.slots[i];
+                    int state = SlotFull;
+                    if (slot.state.compare_exchange_strong(state, SlotReading, std::memory_order_acquire))
+                    {
+                        out.emplace_back();
+                        Decode(slot, out.back());
+                        slot.state.store(SlotEmpty, std::memory_order_release);
+                    }
+                }
+                it = closed ? m_rings.erase(it) : it + 1;
+            }
+            std::stable_sort(out.begin() + static_cast<std::ptrdiff_t>(initialSize), out.end(),
+                             [](const LogRecord& a, const LogRecord& b) { return a.timestamp < b.timestamp; });
+        }
+
+    private:
+        enum SlotState : int
+        {
+            SlotEmpty,
+            SlotWriting,
+            SlotFull,
+            SlotReading
+        };
+
+        /**
+         * The fixed part of a kept record, followed in its slot by the arguments or text and then the module
+         */
+        struct SlotHeader
+        {
+            std::uint64_t timestamp;
+            const char* format;
+            DeferredFormatter formatter;
+            const char* argTypes;
+            std::uint32_t threadId;
+            std::uint32_t payloadSize;
+            std::uint32_t moduleSize;
+            RecordKind kind;
+            LogLevel level;
+        };
+
+        static constexpr std::size_t PayloadOffset =
+            (sizeof(SlotHeader) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) *
+            alignof(std::max_align_t);
+        static constexpr std::size_t PayloadCapacity = LoggerFlightRecorderSlotSize - PayloadOffset;
+
+        struct Slot
+        {
+            std::atomic<int> state{SlotEmpty};
+            // The arguments keep the alignment they had in LogRecord::args, see DeferredStringArg
+            alignas(std::max_align_t) std::array<char, LoggerFlightRecorderSlotSize> bytes{};
+        };
+
+        struct Ring
+        {
+            explicit Ring(std::size_t _size) : slots(new Slot[_size]), size(_size)
+            {
+            }
+
+            std::unique_ptr<Slot[]> slots;
+            const std::size_t size;
+            std::size_t next{0}; // Owning thread only
+            std::atomic<bool> closed{false};
+        };
+
+        static void Encode(const LogRecord& record, Slot& slot)
+        {
+            SlotHeader header{};
+            header.timestamp = record.timestamp;
+            header.format = record.format;
+            header.formatter = record.formatter;
+            header.argTypes = record.argTypes;
+            header.threadId = record.threadId;
+            header.kind = record.kind;
+            header.level = record.level;
+            char* payload = slot.bytes.data() + PayloadOffset;
+
+            bool deferred = record.kind == RecordKind::Deferred || record.kind == RecordKind::Fields;
+            std::size_t moduleSize{};
+            if (deferred && record.argsSize + record.module.size() <= PayloadCapacity)
+            {
+                std::memcpy(payload, record.ArgsData(), record.argsSize);
+                header.payloadSize = static_cast<std::uint32_t>(record.argsSize);
+                moduleSize = record.module.size();
+            }
+            else
+            {
+                const char* text = record.text.data();
+                std::size_t textSize = record.text.size();
+                if (deferred)
+                {
+                    // Too large to keep captured, format it here. Only long LOG_*_KV calls get this far.
+                    static thread_local std::string rendered;
+                    rendered.clear();
+                    if (record.kind == RecordKind::Deferred)
+                    {
+                        record.formatter(record.format, record.args.data(), rendered);
+                    }
+                    else
+                    {
+                        static thread_local std::string scratch;
+                        rendered += record.format;
+                        AppendFields(rendered, record.ArgsData(), record.argTypes, OutputFormat::Text, scratch);
+                    }
+                    text = rendered.data();
+                    textSize = rendered.size();
+                    header.kind = RecordKind::Message;
+                }
+                moduleSize = std::min(record.module.size(), PayloadCapacity / 2);
+                textSize = std::min(textSize, PayloadCapacity - moduleSize);
+                std::memcpy(payload, text, textSize);
+                if (record.kind == RecordKind::Line && textSize > 0 && textSize < record.text.size())
+                {
+                    payload[textSize - 1] = '\n';
+                }
+                header.payloadSize = static_cast<std::uint32_t>(textSize);
+            }
+            std::memcpy(payload + header.payloadSize, record.module.data(), moduleSize);
+            header.moduleSize = static_cast<std::uint32_t>(moduleSize);
+            std::memcpy(slot.bytes.data(), &header, sizeof(header));
+        }
+
+        static void Decode(const Slot& slot, LogRecord& record)
+        {
+            SlotHeader header{};
+            std::memcpy(&header, slot.bytes.data(), sizeof(header));
+            const char* payload = slot.bytes.data() + PayloadOffset;
+            record.timestamp = header.timestamp;
+            record.kind = header.kind;
+            record.level = header.level;
+            record.threadId = header.threadId;
+            record.format = header.format;
+            record.formatter = header.formatter;
+            record.argTypes = header.argTypes;
+            if (header.kind == RecordKind::Deferred || header.kind == RecordKind::Fields)
+            {
+                std::memcpy(record.args.data(), payload, header.payloadSize);
+                record.argsSize = header.payloadSize;
+            }
+            else
+            {
+                record.text.assign(payload, header.payloadSize);
+            }
+            record.module.assign(payload + header.payloadSize, header.moduleSize);
+        }
+
+        /**
+         * The rings owned by one thread, marked closed when the thread exits
+         */
+        struct RingSet
+        {
+            RingSet() = default;
+            RingSet(RingSet const& copy) = delete;
+            RingSet& operator=(RingSet const& copy) = delete;
+
+            ~RingSet()
+            {
+                for (auto& entry : entries)
+                {
+                    entry.second->closed.store(true, std::memory_order_release);
+                }
+            }
+
+            std::vector<std::pair<std::uint64_t, std::shared_ptr<Ring>>> entries{};
+        };
+
+        Ring& LocalRing()
+        {
+            static thread_local RingSet local;
+            auto capacity = m_capacity.load(std::memory_order_relaxed);
+            std::pair<std::uint64_t, std::shared_ptr<Ring>>* entry = nullptr;
+            for (auto& candidate : local.entries)
+            {
+                if (candidate.first == m_id)
+                {
+                    if (candidate.second->size == capacity)
+                    {
+                        return *candidate.second;
+                    }
+                    entry = &candidate;
+                }
+            }
+            auto ring = std::make_shared<Ring>(capacity);
+            if (entry)
+            {
+                // Resized, the old ring is dumped once more and then dropped
+                entry->second->closed.store(true, std::memory_order_release);
+                entry->second = ring;
+            }
+            else
+            {
+                local.entries.emplace_back(m_id, ring);
+            }
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_rings.push_back(ring);
+            return *ring;
+        }
+
+        static std::uint64_t NextRecorderId()
+        {
+            static std::atomic<std::uint64_t> nextId{1};
+            return nextId.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        const std::uint64_t m_id;
+        std::atomic<std::size_t> m_capacity{LoggerFlightRecorderCapacity};
+        std::mutex m_lock{};
+        std::vector<std::shared_ptr<Ring>> m_rings{};
+    };
+
+    /**
+     * Everything behind one output: its level, queue and writer thread, and the writer's counters
+     */
+    struct LogPipeline
+    {
+        explicit LogPipeline(LogLevel logLevel, std::shared_ptr<LogSink> _sink = nullptr)
+            : level(logLevel), sink(std::move(_sink))
+        {
+        }
+
+        LogPipeline(LogPipeline const& copy) = delete;
+        LogPipeline& operator=(LogPipeline const& copy) = delete;
+
+        std::atomic<LogLevel> level;
+        std::atomic<OutputFormat> format{OutputFormat::Text};
+        std::shared_ptr<LogSink> sink;
+        LogQueue queue{LoggerQueueCapacity, LoggerThreadQueueCapacity};
+        WriterStats stats{};
+        std::atomic<bool> exit{false};
+        std::thread writer{};
+
+        // Flush tickets: a flush is done once flushed reaches the ticket it took from flushRequested
+        std::atomic<std::uint64_t> flushRequested{0};
+        std::atomic<std::uint64_t> flushed{0};
+        std::mutex flushLock{};
+        std::vector<std::pair<std::uint64_t, std::shared_ptr<FlushRequest>>> flushWaiters{};
+
+        // The writer's formatted batch until it is written, for FlushFromSignalHandler() to write if it is not
+        std::atomic<const char*> pendingData{nullptr};
+        std::atomic<std::size_t> pendingSize{0};
+    };
+
+    /**
+     * Passed first to LogMessage(), LogFormat(), LogStdFormat() and LogFields() by the macros once their
+     * CallSiteLevel has found the level enabled, so the call does not look the module level up again
+     */
+    struct LevelChecked
+    {
+    };
+
+    /**
+     * Logger class
+     */
+    class SingleLog final
+    {
+    private:
+        /**
+         * Private Constructor
+         * Queues and writer threads are only set up when the first message reaches an output, see StartWriters()
+         */
+        SingleLog() : SingleLog(std::string())
+        {
+        }
+
+        /**
+         * Private Constructor for a named logger
+         */
+        explicit SingleLog(std::string name) : m_name(std::move(name)), m_filePath("")
+        {
+            LinkInstance();
+        }
+
+        /**
+         * Delete copy constructor
+         */
+        SingleLog(SingleLog const& copy) = delete;
+        SingleLog& operator=(SingleLog const& copy) = delete;
+
+    public:
+        /**
+         * Return a reference to the instance of this class
+         * C++11 handles thread safety and removes the need for manual locking
+         * http://stackoverflow.com/questions/8102125/is-local-static-variable-initialization-thread-safe-in-c11
+         * http://stackoverflow.com/questions/33114896/reentrancy-in-static-method-with-static-variable
+         */
+        static SingleLog& GetInstance()
+        {
+            static SingleLog instance;
+            return instance;
+        }
+
+        /**
+         * Return the logger called name, created on first use. Each named logger has its own queues, writer
+         * threads, file, sinks and levels, so one subsystem's logging does not hold up another's. The LOG_* macros
+         * use the default instance, LOG_TO() and friends take a named one. Named loggers last until exit.
+         * An empty name is the default instance.
+         */
+        static SingleLog& GetInstance(const std::string& name)
+        {
+            if (name.empty())
+            {
+                return GetInstance();
+            }
+            auto& named = NamedInstances();
+            std::lock_guard<std::mutex> lock(named.lock);
+            auto& instance = named.instances[name];
+            if (!instance)
+            {
+                instance.reset(new SingleLog(name));
+            }
+            return *instance;
+        }
+
+#if !defined(__cpp_aligned_new)
+        /**
+         * Before C++17, new does not honour the alignment of the cache line aligned members, so named loggers align
+         * their own storage
+         */
+        static void* operator new(std::size_t size)
+        {
+            auto raw = static_cast<char*>(::operator new(size + alignof(SingleLog) + sizeof(void*)));
+            auto aligned = raw + sizeof(void*);
+            auto address = reinterpret_cast<std::uintptr_t>(aligned);
+            aligned += (alignof(SingleLog) - address % alignof(SingleLog)) % alignof(SingleLog);
+            std::memcpy(aligned - sizeof(void*), &raw, sizeof(void*));
+            return aligned;
+        }
+
+        static void operator delete(void* data)
+        {
+            void* raw = nullptr;
+            std::memcpy(&raw, static_cast<char*>(data) - sizeof(void*), sizeof(void*));
+            ::operator delete(raw);
+        }
+#endif
+
+        /**
+         * The name this logger was created with, empty for the default instance
+         */
+        const std::string& Name() const
+        {
+            return m_name;
+        }
+
+        /**
+         * Destructor
+         */
+        ~SingleLog()
+        {
+            UnlinkInstance();
+            StopWriter(m_console);
+            StopWriter(m_file);
+            for (auto& pipeline : m_sinkPipelines)
+            {
+                StopWriter(*pipeline);
+            }
+            if (m_sharedWriter.joinable())
+            {
+                m_sharedWriter.join();
+            }
+            std::lock_guard<std::mutex> lock(m_fstreamLock);
+            if (m_activeFileFormat.load() == OutputFormat::Text)
+            {
+                WriteFile("\n\n");
+            }
+            CloseCrashFile();
+            m_mappedFile.Close();
+            m_uringFile.Close();
+            if (m_fileOut.is_open())
+            {
+                m_fileOut.close();
+            }
+        }
+
+        /**
+         * Set the minimum log level for the console
+         * L_TRACE, L_DEBUG, L_INFO, L_NOTICE, L_WARNING, ERROR, L_CRITICAL, L_OFF
+         */
+        void SetConsoleLogLevel(const LogLevel& logLevel)
+        {
+            std::lock_guard<std::mutex> lock(m_levelLock);
+            m_console.level.store(logLevel);
+            UpdateMinimumLogLevel();
+        }
+
+        /**
+         * Set the minimum log level for the log file
+         * L_TRACE, L_DEBUG, L_INFO, L_NOTICE, L_WARNING, ERROR, L_CRITICAL, L_OFF
+         */
+        void SetFileLogLevel(const LogLevel& logLevel)
+        {
+            std::lock_guard<std::mutex> lock(m_levelLock);
+            m_file.level.store(logLevel);
+            UpdateMinimumLogLevel();
+        }
+
+        /**
+         * True if a message at this level would reach at least one output, whatever its module.
+         * Check this before building a message, disabled levels cost one relaxed load.
+         */
+        bool IsEnabled(LogLevel level) const
+        {
+            return m_minimumLogLevel.load(std::memory_order_relaxed) <= level;
+        }
+
+        /**
+         * True if a message at this level from _module would reach at least one output, with the module levels
+         * applied. The LOG_* macros cache this per call site, see CallSiteLevel.
+         */
+        bool IsEnabled(LogLevel level, const char* _module)
+        {
+            return IsEnabled(level) &&
+                   (!m_hasModuleLevels.load(std::memory_order_relaxed) || ModuleEnabled(level, _module));
+        }
+
+        /**
+         * True if a message at this level from _module would reach at least one output, with the module levels
+         * applied
+         */
+        bool IsEnabled(LogLevel level, const std::string& _module)
+        {
+            return IsEnabled(level, _module.c_str());
+        }
+
+        /**
+         * Set the minimum log level for the modules matching pattern, which can be changed at any time.
+         * A module is the name the macros pass, the calling function, or the _module given to Info() and friends.
+         * In the pattern * stands for any run of characters and ? for any one character, so "Net*" is a prefix
+         * rule. Where several patterns match a module, the one set last wins.
+         * A module level only filters: messages still have to meet an output's level. To see DEBUG from one
+         * subsystem, set the outputs to L_DEBUG, then SetModuleLogLevel("*", L_INFO) and
+         * SetModuleLogLevel("Net*", L_DEBUG).
+         */
+        void SetModuleLogLevel(const std::string& pattern, const LogLevel& logLevel)
+        {
+            std::lock_guard<std::mutex> lock(m_levelLock);
+            m_moduleLevels.erase(std::remove_if(m_moduleLevels.begin(), m_moduleLevels.end(),
+                                                [&pattern](const std::pair<std::string, LogLevel>& rule)
+                                                { return rule.first == pattern; }),
+                                 m_moduleLevels.end());
+            m_moduleLevels.emplace_back(pattern, logLevel);
+            m_hasModuleLevels.store(true, std::memory_order_relaxed);
+            UpdateMinimumLogLevel();
+        }
+
+        /**
+         * Remove every module level set by SetModuleLogLevel()
+         */
+        void ClearModuleLogLevels()
+        {
+            std::lock_guard<std::mutex> lock(m_levelLock);
+            m_moduleLevels.clear();
+            m_hasModuleLevels.store(false, std::memory_order_relaxed);
+            UpdateMinimumLogLevel();
+        }
+
+        /**
+         * The lowest level a message from _module can be logged at: the lowest output level, raised by the last
+         * module level whose pattern matches. This takes a lock, callers cache it against LevelGeneration().
+         */
+        LogLevel ModuleLogLevel(const char* _module)
+        {
+            std::lock_guard<std::mutex> lock(m_levelLock);
+            auto level = m_minimumLogLevel.load(std::memory_order_relaxed);
+            for (auto rule = m_moduleLevels.rbegin(); rule != m_moduleLevels.rend(); ++rule)
+            {
+                if (GlobMatch(rule->first.c_str(), _module))
+                {
+                    return std::max(level, rule->second);
+                }
+            }
+            return level;
+        }
+
+        /**
+         * Counter bumped by every change to an output or module level
+         */
+        std::uint64_t LevelGeneration() const
+        {
+            return m_levelGeneration.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Set the precision of the fractional seconds in each timestamp
+         * TimestampPrecision::Seconds, Milliseconds, Microseconds, Nanoseconds
+         */
+        void SetTimestampPrecision(const TimestampPrecision& precision)
+        {
+            m_timestampPrecision.store(precision);
+        }
+
+        /**
+         * Set how many bytes of formatted messages a writer collects before writing them out in one call
+         */
+        void SetWriteBatchSize(std::size_t bytes)
+        {
+            m_writeBatchSize.store(bytes);
+        }
+
+        /**
+         * Set how long formatted messages may wait in a writer to be batched with later ones.
+         * The default of zero writes as soon as the queue is empty, so only bursts are batched.
+         */
+        void SetMaxFlushLatency(std::chrono::nanoseconds latency)
+        {
+            m_maxFlushLatency.store(latency.count());
+        }
+
+        /**
+         * Set how the writer threads wait for messages once their queues are empty
+         * WakeupPolicy::Park, WakeupPolicy::SpinThenPark, WakeupPolicy::Poll
+         */
+        void SetWriterWakeupPolicy(const WakeupPolicy& policy)
+        {
+            m_wakeupPolicy.store(policy);
+        }
+
+        /**
+         * Set how many times a writer checks its queue before parking under WakeupPolicy::SpinThenPark
+         */
+        void SetWriterSpinCount(std::uint32_t spins)
+        {
+            m_writerSpinCount.store(spins);
+        }
+
+        /**
+         * Set how often a writer checks its queue under WakeupPolicy::Poll
+         */
+        void SetWriterPollInterval(std::chrono::nanoseconds interval)
+        {
+            m_writerPollInterval.store(interval.count());
+        }
+
+        /**
+         * Keep messages at or above this level that the log file does not take in a flight recorder, the last
+         * SetFlightRecorderCapacity() of them per thread, and write them to the log file when a message at the
+         * trigger level is logged. The file can then stay at L_WARNING and still show the L_DEBUG messages that
+         * led up to an error. L_OFF, the default, turns the recorder off.
+         */
+        void SetFlightRecorderLevel(const LogLevel& logLevel)
+        {
+            std::lock_guard<std::mutex> lock(m_levelLock);
+            m_flightRecorderLevel.store(logLevel);
+            UpdateMinimumLogLevel();
+        }
+
+        /**
+         * Set the level at which a message dumps the flight recorder to the log file, L_ERROR by default
+         */
+        void SetFlightRecorderTrigger(const LogLevel& logLevel)
+        {
+            m_flightRecorderTrigger.store(logLevel);
+        }
+
+        /**
+         * Set how many messages the flight recorder keeps for each logging thread
+         */
+        void SetFlightRecorderCapacity(std::size_t records)
+        {
+            m_flightRecorder.SetCapacity(records);
+        }
+
+        /**
+         * Write the flight recorder's messages to the log file now, oldest first, and empty it. Returns how many
+         * there were.
+         */
+        std::size_t DumpFlightRecorder()
+        {
+            std::vector<LogRecord> records;
+            m_flightRecorder.Collect(records);
+            if (records.empty())
+            {
+                return 0;
+            }
+            if (!m_writersStarted.load(std::memory_order_acquire))
+            {
+                StartWriters();
+            }
+            for (auto& record : records)
+            {
+                m_file.queue.Push(QueuedRecord(std::move(record)));
+            }
+            return records.size();
+        }
+
+        /**
+         * Choose between a writer thread per output and one shared by all of them
+         * WriterThreads::PerOutput, WriterThreads::Shared
+         * Takes effect only before the writers start, returns false after that.
+         */
+        bool SetWriterThreads(const WriterThreads& threads)
+        {
+            std::lock_guard<std::mutex> lock(m_sinkLock);
+            if (m_writersStarted.load())
+            {
+                return false;
+            }
+            m_writerThreads.store(threads);
+            return true;
+        }
+
+        /**
+         * Start the writer threads. They are otherwise started by the first message that reaches an output, so a
+         * process that never logs never starts them. Call this to keep thread creation out of that first message.
+         */
+        void StartWriters()
+        {
+            std::lock_guard<std::mutex> lock(m_sinkLock);
+            if (m_writersStarted.load())
+            {
+                return;
+            }
+            std::lock_guard<std::mutex> threadLock(m_threadLock);
+            StartWriter(m_console);
+            StartWriter(m_file);
+            for (auto& pipeline : m_sinkPipelines)
+            {
+                StartWriter(*pipeline);
+            }
+            if (m_writerThreads.load() == WriterThreads::Shared)
+            {
+                m_sharedWriter = std::thread(&SingleLog::SharedWriter, this);
+                ConfigureWriterThread(m_sharedWriter);
+            }
+            m_writersStarted.store(true, std::memory_order_release);
+        }
+
+        /**
+         * Pin the writer threads (console, file, sinks and trace) to the given CPUs, e.g. to keep them off latency
+         * critical cores. Writers started later are pinned too. Linux only, returns false elsewhere or if a CPU
+         * cannot be used.
+         */
+        bool SetWriterAffinity(const std::vector<int>& cpus)
+        {
+            std::lock_guard<std::mutex> sinkLock(m_sinkLock);
+            std::lock_guard<std::mutex> lock(m_threadLock);
+            m_writerCpus = cpus;
+            return ConfigureWriterThreads();
+        }
+
+        /**
+         * Set the scheduling policy and priority of the writer threads, as for pthread_setschedparam, e.g.
+         * SCHED_IDLE or SCHED_BATCH with priority 0 to keep them out of the way of the application's threads.
+         * Writers started later get it too. Returns false on Windows or if the system refuses.
+         */
+        bool SetWriterScheduling(int policy, int priority)
+        {
+            std::lock_guard<std::mutex> sinkLock(m_sinkLock);
+            std::lock_guard<std::mutex> lock(m_threadLock);
+            m_hasWriterScheduling = true;
+            m_writerPolicy = policy;
+            m_writerPriority = priority;
+            return ConfigureWriterThreads();
+        }
+
+        /**
+         * Ask every writer to write out what was queued before this call, regardless of batch size and flush
+         * latency. The future is ready once all of them have handed it to their output.
+         */
+        std::future<void> FlushAsync()
+        {
+            auto request = std::make_shared<FlushRequest>();
+            auto future = request->done.get_future();
+            std::array<LogPipeline*, LoggerMaxSinks + 2> pipelines;
+            // Nothing has been logged while the writers have not started
+            auto count = m_writersStarted.load(std::memory_order_acquire) ? Pipelines(pipelines) : 0;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                auto& pipeline = *pipelines[i];
+                {
+                    std::lock_guard<std::mutex> lock(pipeline.flushLock);
+                    if (pipeline.exit.load())
+                    {
+                        continue;
+                    }
+                    auto ticket = pipeline.flushRequested.fetch_add(1) + 1;
+                    request->remaining.fetch_add(1, std::memory_order_relaxed);
+                    pipeline.flushWaiters.emplace_back(ticket, request);
+                }
+                pipeline.queue.Notify();
+            }
+            request->Release();
+            return future;
+        }
+
+        /**
+         * Block until everything logged before this call has been written out
+         */
+        void Flush()
+        {
+            FlushAsync().wait();
+        }
+
+        /**
+         * Block until everything logged before this call has been written out, or timeout passes.
+         * Returns false on timeout.
+         */
+        bool Flush(std::chrono::milliseconds timeout)
+        {
+            return FlushAsync().wait_for(timeout) == std::future_status::ready;
+        }
+
+        /**
+         * Flush from a signal handler. Every writer is asked to write out what is queued and waited for until
+         * timeout passes; once crash handlers are installed writers check for this at least every
+         * LoggerCrashWakeInterval, so nothing needs waking. The batch a console or file writer has formatted but
+         * not written, because it is the thread that crashed or ran out of time, is then written here with
+         * write() and pwrite(). Only atomics and async-signal-safe calls are used. Returns false on timeout.
+         */
+        bool FlushFromSignalHandler(std::chrono::nanoseconds timeout)
+        {
+            std::array<LogPipeline*, LoggerMaxSinks + 2> pipelines;
+            std::array<std::uint64_t, LoggerMaxSinks + 2> tickets;
+            auto count = m_writersStarted.load(std::memory_order_acquire) ? Pipelines(pipelines) : 0;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                tickets[i] = pipelines[i]->flushRequested.fetch_add(1) + 1;
+            }
+            // A writer cannot flush while it is the thread that crashed, or after it has stopped
+            auto pending = [this, &pipelines, &tickets](std::size_t i) {
+                auto& pipeline = *pipelines[i];
+                return pipeline.flushed.load(std::memory_order_acquire) < tickets[i] && !pipeline.exit.load() &&
+                       WriterThreadId(pipeline) != std::this_thread::get_id();
+            };
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            bool flushed = false;
+            while (!flushed && std::chrono::steady_clock::now() < deadline)
+            {
+                flushed = true;
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    flushed = flushed && !pending(i);
+                }
+                std::this_thread::yield();
+            }
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                if (pipelines[i]->flushed.load(std::memory_order_acquire) < tickets[i])
+                {
+                    WritePendingFromSignalHandler(*pipelines[i]);
+                }
+            }
+            return flushed;
+        }
+
+        /**
+         * Flush the queued messages when the process crashes, so large batch sizes and flush latencies do not lose
+         * its last messages. Handles SIGSEGV, SIGABRT, SIGILL, SIGFPE (and SIGBUS where there is one) with
+         * FlushFromSignalHandler(), then raises the signal again for the handler that was there before, and
+         * std::terminate with Flush(), then calls the previous terminate handler. Each waits up to
+         * LoggerCrashFlushTimeout. From then on idle writers wake every LoggerCrashWakeInterval.
+         */
+        static void InstallCrashHandlers()
+        {
+            auto& crash = CrashState();
+            crash.installed.store(true);
+            for (std::size_t i = 0; i < crash.signals.size(); ++i)
+            {
+                crash.previous[i] = std::signal(crash.signals[i], &SingleLog::OnFatalSignal);
+            }
+            crash.previousTerminate = std::set_terminate(&SingleLog::OnTerminate);
+        }
+
+        /**
+         * Set how logging threads hand messages to the writer threads
+         * QueueMode::Shared, QueueMode::PerThread
+         */
+        void SetQueueMode(const QueueMode& mode)
+        {
+            std::lock_guard<std::mutex> lock(m_sinkLock);
+            m_queueMode.store(mode);
+            m_console.queue.SetQueueMode(mode);
+            m_file.queue.SetQueueMode(mode);
+            for (auto& pipeline : m_sinkPipelines)
+            {
+                pipeline->queue.SetQueueMode(mode);
+            }
+        }
+
+        /**
+         * Set how many messages may wait for the console writer, at most SINGLELOG_MAX_QUEUE_CAPACITY.
+         * In QueueMode::PerThread this limits each thread's buffer, which is allocated with LoggerThreadQueueCapacity.
+         */
+        void SetConsoleQueueCapacity(std::size_t records)
+        {
+            m_console.queue.SetCapacity(records);
+        }
+
+        /**
+         * Set how many messages may wait for the file writer, at most SINGLELOG_MAX_QUEUE_CAPACITY.
+         * In QueueMode::PerThread this limits each thread's buffer, which is allocated with LoggerThreadQueueCapacity.
+         */
+        void SetFileQueueCapacity(std::size_t records)
+        {
+            m_file.queue.SetCapacity(records);
+        }
+
+        /**
+         * Set how many messages may wait for the writer of a sink added with AddSink(), at most
+         * SINGLELOG_MAX_QUEUE_CAPACITY.
+         * In QueueMode::PerThread this limits each thread's buffer, which is allocated with LoggerThreadQueueCapacity.
+         */
+        void SetSinkQueueCapacity(const std::shared_ptr<LogSink>& sink, std::size_t records)
+        {
+            std::lock_guard<std::mutex> lock(m_sinkLock);
+            for (auto& pipeline : m_sinkPipelines)
+            {
+                if (pipeline->sink == sink)
+                {
+                    pipeline->queue.SetCapacity(records);
+                }
+            }
+        }
+
+        /**
+         * Set what logging threads do when the console queue is full
+         * OverflowPolicy::Block, OverflowPolicy::DropNewest, OverflowPolicy::DropOldest, OverflowPolicy::DropBelowLevel
+         */
+        void SetConsoleOverflowPolicy(const OverflowPolicy& policy)
+        {
+            m_console.queue.SetOverflowPolicy(policy);
+        }
+
+        /**
+         * Set what logging threads do when the file queue is full
+         * OverflowPolicy::Block, OverflowPolicy::DropNewest, OverflowPolicy::DropOldest, OverflowPolicy::DropBelowLevel
+         */
+        void SetFileOverflowPolicy(const OverflowPolicy& policy)
+        {
+            m_file.queue.SetOverflowPolicy(policy);
+        }
+
+        /**
+         * Set what logging threads do when the queue of a sink added with AddSink() is full
+         * OverflowPolicy::Block, OverflowPolicy::DropNewest, OverflowPolicy::DropOldest, OverflowPolicy::DropBelowLevel
+         */
+        void SetSinkOverflowPolicy(const std::shared_ptr<LogSink>& sink, const OverflowPolicy& policy)
+        {
+            std::lock_guard<std::mutex> lock(m_sinkLock);
+            for (auto& pipeline : m_sinkPipelines)
+            {
+                if (pipeline->sink == sink)
+                {
+                    pipeline->queue.SetOverflowPolicy(policy);
+                }
+            }
+        }
+
+        /**
+         * Snapshot of the logger's counters. Every counter is a relaxed atomic read, so this can be polled from any
+         * thread without slowing logging down, but the values are not read at exactly the same instant.
+         */
+        LoggerStats GetStats() const
+        {
+            LoggerStats stats;
+            CollectStats(m_console, stats.console);
+            CollectStats(m_file, stats.file);
+            auto sinks = m_sinkCount.load(std::memory_order_acquire);
+            stats.sinks.resize(sinks);
+            for (std::size_t i = 0; i < sinks; ++i)
+            {
+                CollectStats(*m_sinks[i], stats.sinks[i]);
+            }
+            stats.traceSpans = m_trace.WrittenCount();
+            stats.traceSpansDropped = m_trace.DroppedCount();
+            return stats;
+        }
+
+        /**
+         * Add an output receiving every message at or above logLevel. Each sink gets its own queue and writer thread,
+         * unless the writer thread is shared.
+         * Messages going to several outputs are shared between their queues rather than copied, and their text line
+         * is formatted once for all of them. Returns false once LoggerMaxSinks sinks have been added.
+         */
+        bool AddSink(std::shared_ptr<LogSink> sink, const LogLevel& logLevel)
+        {
+            std::lock_guard<std::mutex> lock(m_sinkLock);
+            auto sinks = m_sinkCount.load(std::memory_order_relaxed);
+            if (!sink || sinks == LoggerMaxSinks)
+            {
+                return false;
+            }
+            auto pipeline = std::make_unique<LogPipeline>(logLevel, std::move(sink));
+            pipeline->queue.SetQueueMode(m_queueMode.load());
+            if (m_writersStarted.load())
+            {
+                std::lock_guard<std::mutex> threadLock(m_threadLock);
+                StartWriter(*pipeline);
+            }
+            m_sinks[sinks] = pipeline.get();
+            m_sinkPipelines.push_back(std::move(pipeline));
+            // Publish the pipeline before raising the minimum level, or its first messages could be filtered out
+            m_sinkCount.store(sinks + 1, std::memory_order_release);
+            std::lock_guard<std::mutex> levelLock(m_levelLock);
+            UpdateMinimumLogLevel();
+            return true;
+        }
+
+        /**
+         * Set the minimum log level for a sink added with AddSink()
+         * L_TRACE, L_DEBUG, L_INFO, L_NOTICE, L_WARNING, ERROR, L_CRITICAL, L_OFF
+         */
+        void SetSinkLogLevel(const std::shared_ptr<LogSink>& sink, const LogLevel& logLevel)
+        {
+            std::lock_guard<std::mutex> lock(m_sinkLock);
+            for (auto& pipeline : m_sinkPipelines)
+            {
+                if (pipeline->sink == sink)
+                {
+                    std::lock_guard<std::mutex> levelLock(m_levelLock);
+                    pipeline->level.store(logLevel);
+                    UpdateMinimumLogLevel();
+                }
+            }
+        }
+
+        /**
+         * Set the layout of the console output, OutputFormat::Binary is written as Text
+         * OutputFormat::Text, OutputFormat::Json, OutputFormat::Logfmt
+         */
+        void SetConsoleOutputFormat(const OutputFormat& format)
+        {
+            m_console.format.store(format);
+        }
+
+        /**
+         * Set the layout of the lines passed to a sink added with AddSink(), OutputFormat::Binary is written as Text
+         * OutputFormat::Text, OutputFormat::Json, OutputFormat::Logfmt
+         */
+        void SetSinkOutputFormat(const std::shared_ptr<LogSink>& sink, const OutputFormat& format)
+        {
+            std::lock_guard<std::mutex> lock(m_sinkLock);
+            for (auto& pipeline : m_sinkPipelines)
+            {
+                if (pipeline->sink == sink)
+                {
+                    pipeline->format.store(format);
+                }
+            }
+        }
+
+        /**
+         * Set the layout of the log file, applies from the next SetLogFilePath()
+         * OutputFormat::Text, OutputFormat::Binary, OutputFormat::Json, OutputFormat::Logfmt
+         */
+        void SetFileOutputFormat(const OutputFormat& format)
+        {
+            m_fileOutputFormat.store(format);
+        }
+
+        /**
+         * Set how the log file is written, applies from the next SetLogFilePath()
+         * FileSinkMode::Stream, FileSinkMode::MemoryMapped, FileSinkMode::IoUring
+         */
+        void SetFileSinkMode(const FileSinkMode& mode)
+        {
+            m_fileSinkMode.store(mode);
+        }
+
+        /**
+         * Set the path to the log file
+         */
+        void SetLogFilePath(const std::string& filePath)
+        {
+            std::lock_guard<std::mutex> lock(m_fstreamLock);
+            m_filePath = filePath;
+            m_activeFileFormat.store(m_fileOutputFormat.load());
+            ++m_fileGeneration;
+            CloseCrashFile();
+            m_mappedFile.Close();
+            m_uringFile.Close();
+            if (m_fileOut.is_open())
+            {
+                m_fileOut.close();
+            }
+            m_fileEnd.store(0);
+            auto mode = m_fileSinkMode.load();
+            if (!(mode == FileSinkMode::MemoryMapped && m_mappedFile.Open(m_filePath, LoggerMappedSegmentSize)) &&
+                !(mode == FileSinkMode::IoUring && m_uringFile.Open(m_filePath)))
+            {
+                m_fileOut.open(m_filePath, std::ios_base::out);
+                if (m_fileOut.is_open())
+                {
+                    m_fileOut.rdbuf()->pubsetbuf(m_writeBuffer.data(), LogggerInternalBufferSize);
+                }
+            }
+#ifndef WIN32
+            m_crashFd.store(::open(m_filePath.c_str(), O_WRONLY | O_CLOEXEC));
+#endif
+        }
+
+        /**
+         * Set the path to the log file
+         */
+        void SetLogFilePath(const std::wstring& filePath)
+        {
+            SetLogFilePath(ToNarrow(filePath));
+        }
+
+        /**
+         * Record LOG_FUNCTION_TRACE scopes as Chrome trace events in filePath, or stop with an empty path.
+         * While a trace is recorded the scopes go there instead of being logged as TRACE messages.
+         * Returns false if the file cannot be created.
+         */
+        bool SetTraceFilePath(const std::string& filePath)
+        {
+            if (filePath.empty())
+            {
+                m_trace.Stop();
+                return true;
+            }
+            if (!m_trace.Start(filePath))
+            {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(m_threadLock);
+            m_trace.ConfigureWriter([this](std::thread& writer) { ConfigureWriterThread(writer); });
+            return true;
+        }
+
+        /**
+         * Record LOG_FUNCTION_TRACE scopes as Chrome trace events in filePath, or stop with an empty path
+         */
+        bool SetTraceFilePath(const std::wstring& filePath)
+        {
+            return SetTraceFilePath(ToNarrow(filePath));
+        }
+
+        /**
+         * True while LOG_FUNCTION_TRACE scopes are recorded to a trace file
+         */
+        bool IsTracing() const
+        {
+            return m_trace.IsActive();
+        }
+
+        /**
+         * Queue a finished LOG_FUNCTION_TRACE scope for the trace file
+         */
+        void RecordTrace(const TraceSite& site, std::uint64_t begin, std::uint64_t end)
+        {
+            m_trace.Record(site, begin, end);
+        }
+
+        /**
+         * Log the line to console and/or file
+         */
+        void LogIt(LogLevel level, const std::string& line)
+        {
+            LogRecord record{};
+            record.timestamp = Clock::Now();
+            record.threadId = CurrentThreadId();
+            record.kind = RecordKind::Line;
+            record.level = level;
+            record.text.assign(line.data(), line.size());
+            Dispatch(std::move(record));
+        }
+
+        /**
+         * Queue a message, copying the module and message straight into the record rather than through
+         * std::string temporaries
+         */
+        void LogMessage(LogLevel level, const char* _module, const char* _message)
+        {
+            if (IsEnabled(level, _module))
+            {
+                LogMessage(LevelChecked{}, level, _module, _message);
+            }
+        }
+
+        void LogMessage(LogLevel level, const char* _module, const std::string& _message)
+        {
+            if (IsEnabled(level, _module))
+            {
+                LogMessage(LevelChecked{}, level, _module, _message);
+            }
+        }
+
+        /**
+         * Queue a message from the LOG_* macros, which have already checked the level
+         */
+        void LogMessage(LevelChecked, LogLevel level, const char* _module, const char* _message)
+        {
+            QueueMessage(level, _module, std::strlen(_module), _message, std::strlen(_message));
+        }
+
+        void LogMessage(LevelChecked, LogLevel level, const char* _module, const std::string& _message)
+        {
+            QueueMessage(level, _module, std::strlen(_module), _message.data(), _message.size());
+        }
+
+        /**
+         * Log a printf style message.
+         * With a string literal format only its address and a copy of the arguments are queued, and the writer
+         * thread does the formatting. Any other format, a std::string, a pointer or a char array, is formatted on
+         * the calling thread. A const char array is taken for a literal, so it has to outlive the write, e.g. be
+         * static.
+         */
+        template <typename Format, typename... Args>
+        void LogFormat(LogLevel level, const char* _module, Format&& format, const Args&... args)
+        {
+            if (IsEnabled(level, _module))
+            {
+                LogFormat(LevelChecked{}, level, _module, std::forward<Format>(format), args...);
+            }
+        }
+
+        /**
+         * Log a printf style message from the LOGF_* macros, which have already checked the level
+         */
+        template <typename Format, typename... Args>
+        void LogFormat(LevelChecked, LogLevel level, const char* _module, Format&& format, const Args&... args)
+        {
+            QueueFormat(IsFormatLiteral<Format>{}, level, _module, format, args...);
+        }
+
+#if SINGLELOG_HAS_STD_FORMAT
+        /**
+         * Log a std::format style message from the LOGFMT_* macros.
+         * The format string is checked against the arguments at compile time and formatted in a single pass
+         * straight into the record's pooled buffer.
+         */
+        template <typename... Args>
+        void LogStdFormat(LogLevel level, const char* _module, std::format_string<Args...> format, Args&&... args)
+        {
+            if (IsEnabled(level, _module))
+            {
+                LogStdFormat(LevelChecked{}, level, _module, format, std::forward<Args>(args)...);
+            }
+        }
+
+        template <typename... Args>
+        void LogStdFormat(LevelChecked, LogLevel level, const char* _module, std::format_string<Args...> format,
+                          Args&&... args)
+        {
+            LogRecord record{};
+            record.timestamp = Clock::Now();
+            record.threadId = CurrentThreadId();
+            record.kind = RecordKind::Message;
+            record.level = level;
+            record.module = _module;
+            std::format_to(std::back_inserter(record.text), format, std::forward<Args>(args)...);
+            Dispatch(std::move(record));
+        }
+
+        /**
+         * LOGFMT_*("text") without arguments. The text is still checked at compile time, then copied into the
+         * record with its {{ and }} escapes undone instead of going through std::format_to.
+         */
+        void LogStdFormat(LevelChecked, LogLevel level, const char* _module, std::format_string<> format)
+        {
+            LogRecord record{};
+            record.timestamp = Clock::Now();
+            record.threadId = CurrentThreadId();
+            record.kind = RecordKind::Message;
+            record.level = level;
+            record.module = _module;
+            const std::string_view text = format.get();
+            std::size_t start = 0;
+            for (std::size_t i = 0; i < text.size(); ++i)
+            {
+                // A checked format without arguments can only hold braces as {{ or }}
+                if (text[i] == '{' || text[i] == '}')
+                {
+                    record.text.append(text.data() + start, i + 1 - start);
+                    start = ++i + 1;
+                }
+            }
+            record.text.append(text.data() + start, text.size() - start);
+            Dispatch(std::move(record));
+        }
+#endif
+
+        /**
+         * Log a message with key-value fields from the LOG_*_KV macros, e.g.
+         * LOG_INFO_KV("request done", "user", id, "latency_us", latency). Keys must be strings and the message a
+         * literal, which the macros enforce by passing "" before it. The values are captured as they are, like
+         * LOGF_* arguments, and rendered by the writer thread.
+         */
+        template <std::size_t N, typename... Fields>
+        void LogFields(LogLevel level, const char* _module, const char (&message)[N], const Fields&... fields)
+        {
+            if (IsEnabled(level, _module))
+            {
+                LogFields(LevelChecked{}, level, _module, message, fields...);
+            }
+        }
+
+        template <std::size_t N, typename... Fields>
+        void LogFields(LevelChecked, LogLevel level, const char* _module, const char (&message)[N],
+                       const Fields&... fields)
+        {
+            static_assert(ValidFieldTypes<typename std::decay<Fields>::type...>(),
+                          "LOG_*_KV fields must be pairs of a string key and a value LOGF_* could capture");
+            LogRecord record{};
+            record.timestamp = Clock::Now();
+            record.threadId = CurrentThreadId();
+            record.level = level;
+            record.module = _module;
+            record.kind = RecordKind::Fields;
+            record.format = message;
+            record.argTypes = DeferredArgTypes<typename std::decay<Fields>::type...>();
+            char* begin = record.args.data();
+            char* cursor = begin;
+            if (!EncodeDeferredArgs(cursor, begin + record.args.size(), 0, fields...))
+            {
+                // Too large for the record, move the fields to the heap rather than flatten them into text
+                record.spilledArgs.resize(record.args.size() / sizeof(std::max_align_t));
+                do
+                {
+                    record.spilledArgs.resize(record.spilledArgs.size() * 2);
+                    begin = reinterpret_cast<char*>(record.spilledArgs.data());
+                    cursor = begin;
+                } while (!EncodeDeferredArgs(cursor, begin + record.spilledArgs.size() * sizeof(std::max_align_t), 0,
+                                             fields...));
+            }
+            record.argsSize = static_cast<std::size_t>(cursor - begin);
+            Dispatch(std::move(record));
+        }
+
+        /**
+         * Only the message's address is queued, so a message in a char array could be gone before it is written
+         */
+        template <std::size_t N, typename... Fields>
+        void LogFields(LogLevel level, const char* _module, char (&message)[N], const Fields&... fields) = delete;
+
+        /**
+         * Log how many messages a rate limited call site held back, from the LOG_EVERY_MS and LOG_RATE_LIMITED
+         * macros when the next message gets through
+         */
+        void LogSuppressed(LogLevel level, const char* _module, std::uint64_t suppressed)
+        {
+            if (suppressed > 0)
+            {
+                LogFormat(level, _module, "%llu similar messages suppressed",
+                          static_cast<unsigned long long>(suppressed));
+            }
+        }
+
+        /**
+         * Log a printf style message whose format is not a literal, formatted on the calling thread
+         */
+        template <typename... Args>
+        void LogFormat(LogLevel level, const std::string& _module, const std::string& format, const Args&... args)
+        {
+            if (IsEnabled(level, _module))
+            {
+                Log(level, _module, StringTools::string_format(format, PrintfArg(TerminatedArg(args))...));
+            }
+        }
+
+        /**
+         * Log TRACE level messages
+         */
+        void Trace(const std::string& _module, const std::string& _message)
+        {
+            Log(LogLevel::L_TRACE, _module, _message);
+        }
+
+        /**
+         * Log TRACE level messages
+         */
+        void Trace(const std::wstring& _module, const std::wstring& _message)
+        {
+            Log(LogLevel::L_TRACE, _module, _message);
+        }
+
+        /**
+         * Log DEBUG level messages
+         */
+        void Debug(const std::string& _module, const std::string& _message)
+        {
+            Log(LogLevel::L_DEBUG, _module, _message);
+        }
+
+        /**
+         * Log DEBUG level messages
+         */
+        void Debug(const std::wstring& _module, const std::wstring& _message)
+        {
+            Log(LogLevel::L_DEBUG, _module, _message);
+        }
+
+        /**
+         * Log INFO level messages
+         */
+        void Info(const std::string& _module, const std::string& _message)
+        {
+            Log(LogLevel::L_INFO, _module, _message);
+        }
+
+        /**
+         * Log INFO level messages
+         */
+        void Info(const std::wstring& _module, const std::wstring& _message)
+        {
+            Log(LogLevel::L_INFO, _module, _message);
+        }
+
+        /**
+         * Log NOTICE level messages
+         */
+        void Notice(const std::string& _module, const std::string& _message)
+        {
+            Log(LogLevel::L_NOTICE, _module, _message);
+        }
+
+        /**
+         * Log NOTICE level messages
+         */
+        void Notice(const std::wstring& _module, const std::wstring& _message)
+        {
+            Log(LogLevel::L_NOTICE, _module, _message);
+        }
+
+        /**
+         * Log WARNING level messages
+         */
+        void Warning(const std::string& _module, const std::string& _message)
+        {
+            Log(LogLevel::L_WARNING, _module, _message);
+        }
+
+        /**
+         * Log WARNING level messages
+         */
+        void Warning(const std::wstring& _module, const std::wstring& _message)
+        {
+            Log(LogLevel::L_WARNING, _module, _message);
+        }
+
+        /**
+         * Log ERROR level messages
+         */
+        void Error(const std::string& _module, const std::string& _message)
+        {
+            Log(LogLevel::L_ERROR, _module, _message);
+        }
+
+        /**
+         * Log ERROR level messages
+         */
+        void Error(const std::wstring& _module, const std::wstring& _message)
+        {
+            Log(LogLevel::L_ERROR, _module, _message);
+        }
+
+        /**
+         * Log CRITICAL level messages
+         */
+        void Critical(const std::string& _module, const std::string& _message)
+        {
+            Log(LogLevel::L_CRITICAL, _module, _message);
+        }
+
+        /**
+         * Log CRITICAL level messages
+         */
+        void Critical(const std::wstring& _module, const std::wstring& _message)
+        {
+            Log(LogLevel::L_CRITICAL, _module, _message);
+        }
+
+    private:
+        static void CollectStats(const LogPipeline& pipeline, SinkStats& stats)
+        {
+            const auto& writerStats = pipeline.stats;
+            pipeline.queue.CollectStats(stats);
+            stats.written = writerStats.written.load(std::memory_order_relaxed);
+            stats.bytesWritten = writerStats.bytesWritten.load(std::memory_order_relaxed);
+            stats.writeErrors = writerStats.writeErrors.load(std::memory_order_relaxed);
+            stats.writerBusyNanos = writerStats.busyNanos.load(std::memory_order_relaxed);
+            stats.queueLatency = writerStats.queueLatency.Snapshot();
+            stats.writeLatency = writerStats.writeLatency.Snapshot();
+        }
+
+        /**
+         * Keep the combined threshold used by IsEnabled() in step with the per output levels, and bump the
+         * generation so cached call site and module levels are resolved again. Call with m_levelLock.
+         */
+        void UpdateMinimumLogLevel()
+        {
+            auto minimum = std::min({m_console.level.load(), m_file.level.load(), m_flightRecorderLevel.load()});
+            auto sinks = m_sinkCount.load(std::memory_order_acquire);
+            for (std::size_t i = 0; i < sinks; ++i)
+            {
+                minimum = std::min(minimum, m_sinks[i]->level.load());
+            }
+            m_minimumLogLevel.store(minimum, std::memory_order_relaxed);
+            m_levelGeneration.store(NextLevelGeneration(), std::memory_order_release);
+        }
+
+        /**
+         * Check a module against the module levels through a per thread cache of resolved modules, so messages
+         * from the API and those that passed a macro's call site check do not match patterns every time
+         */
+        bool ModuleEnabled(LogLevel level, const char* _module)
+        {
+            struct ModuleCache
+            {
+                const SingleLog* owner{nullptr};
+                std::uint64_t generation{0};
+                std::unordered_map<std::string, LogLevel> levels{};
+            };
+            static thread_local ModuleCache cache;
+            auto generation = LevelGeneration();
+            if (cache.owner != this || cache.generation != generation || cache.levels.size() >= LoggerModuleCacheSize)
+            {
+                cache.owner = this;
+                cache.generation = generation;
+                cache.levels.clear();
+            }
+            auto found = cache.levels.find(_module);
+            if (found == cache.levels.end())
+            {
+                found = cache.levels.emplace(_module, ModuleLogLevel(_module)).first;
+            }
+            return found->second <= level;
+        }
+
+        /**
+         * Queue a message from the wide API, transcoded straight into the record
+         */
+        void Log(LogLevel level, const std::wstring& _module, const std::wstring& _message)
+        {
+            if (!IsEnabled(level))
+            {
+                return;
+            }
+            LogRecord record{};
+            AppendUtf8(_module.data(), _module.size(), record.module);
+            if (!IsEnabled(level, record.module.c_str()))
+            {
+                return;
+            }
+            record.timestamp = Clock::Now();
+            record.threadId = CurrentThreadId();
+            record.kind = RecordKind::Message;
+            record.level = level;
+            AppendUtf8(_message.data(), _message.size(), record.text);
+            Dispatch(std::move(record));
+        }
+
+        /**
+         * Queue a message, the writers add the timestamp, level and module
+         */
+        void Log(LogLevel level, const std::string& _module, const std::string& _message)
+        {
+            if (!IsEnabled(level, _module))
+            {
+                return;
+            }
+            QueueMessage(level, _module.data(), _module.size(), _message.data(), _message.size());
+        }
+
+        template <typename Format>
+        struct IsFormatLiteral : std::false_type
+        {
+        };
+
+        template <std::size_t N>
+        struct IsFormatLiteral<const char (&)[N]> : std::true_type
+        {
+        };
+
+        /**
+         * Queue a printf style message with a literal format, capturing the arguments for the writer thread
+         */
+        template <typename... Args>
+        void QueueFormat(std::true_type, LogLevel level, const char* _module, const char* format,
+                         const Args&... args)
+        {
+            LogRecord record{};
+            record.timestamp = Clock::Now();
+            record.threadId = CurrentThreadId();
+            record.level = level;
+            record.module = _module;
+            char* cursor = record.args.data();
+            std::uint64_t addresses =
+                HasCharPointers<typename std::decay<Args>::type...>() ? NonStringConversions(format) : 0;
+            if (EncodeDeferredArgs(cursor, record.args.data() + record.args.size(), addresses, args...))
+            {
+                record.kind = RecordKind::Deferred;
+                record.format = format;
+                record.formatter = &FormatDeferred<typename std::decay<Args>::type...>;
+                record.argTypes = DeferredArgTypes<typename std::decay<Args>::type...>();
+                record.argsSize = static_cast<std::size_t>(cursor - record.args.data());
+            }
+            else
+            {
+                // Too large to capture, format here instead
+                record.kind = RecordKind::Message;
+                auto text = StringTools::string_format(format, PrintfArg(TerminatedArg(args))...);
+                record.text.assign(text.data(), text.size());
+            }
+            Dispatch(std::move(record));
+        }
+
+        /**
+         * A format that is not a literal may not outlive the call, so it is formatted on the calling thread
+         */
+        template <typename Format, typename... Args>
+        void QueueFormat(std::false_type, LogLevel level, const char* _module, const Format& format,
+                         const Args&... args)
+        {
+            LogMessage(LevelChecked{}, level, _module,
+                       StringTools::string_format(format, PrintfArg(TerminatedArg(args))...));
+        }
+
+        /**
+         * Copy a message into a record and queue it
+         */
+        void QueueMessage(LogLevel level, const char* _module, std::size_t moduleLength, const char* _message,
+                          std::size_t messageLength)
+        {
+            LogRecord record{};
+            record.timestamp = Clock::Now();
+            record.threadId = CurrentThreadId();
+            record.kind = RecordKind::Message;
+            record.level = level;
+            record.module.assign(_module, moduleLength);
+            record.text.assign(_message, messageLength);
+            Dispatch(std::move(record));
+        }
+
+        /**
+         * Send a record to the queue of every output whose level it meets.
+         * A record for one output is moved into its queue, one for several is shared between them by reference count.
+         * A record below the log file's level is kept by the flight recorder, if it is on.
+         */
+        void Dispatch(LogRecord&& record)
+        {
+            std::array<LogPipeline*, LoggerMaxSinks + 2> targets;
+            std::size_t count = 0;
+            if (m_console.level.load() <= record.level)
+            {
+                targets[count++] = &m_console;
+            }
+            if (m_file.level.load() <= record.level)
+            {
+                targets[count++] = &m_file;
+            }
+            auto sinks = m_sinkCount.load(std::memory_order_acquire);
+            for (std::size_t i = 0; i < sinks; ++i)
+            {
+                if (m_sinks[i]->level.load() <= record.level)
+                {
+                    targets[count++] = m_sinks[i];
+                }
+            }
+
+            auto flightLevel = m_flightRecorderLevel.load(std::memory_order_relaxed);
+            if (flightLevel <= record.level && record.level < m_file.level.load())
+            {
+                m_flightRecorder.Record(record);
+            }
+            if (count == 0)
+            {
+                return;
+            }
+            if (!m_writersStarted.load(std::memory_order_acquire))
+            {
+                StartWriters();
+            }
+            auto trigger = m_flightRecorderTrigger.load(std::memory_order_relaxed);
+            if (flightLevel != LogLevel::L_OFF && trigger <= record.level)
+            {
+                // Ahead of the trigger, which is then written after what led up to it
+                DumpFlightRecorder();
+            }
+
+            if (count == 1)
+            {
+                targets[0]->queue.Push(QueuedRecord(std::move(record)));
+            }
+            else
+            {
+                auto shared = std::allocate_shared<SharedRecord>(PoolAllocator<SharedRecord>(), std::move(record));
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    targets[i]->queue.Push(QueuedRecord(shared));
+                }
+            }
+        }
+
+        /**
+         * Apply the writer affinity and scheduling to every writer thread. Call with m_sinkLock and m_threadLock.
+         */
+        bool ConfigureWriterThreads()
+        {
+            bool configured = ConfigureWriterThread(m_console.writer) && ConfigureWriterThread(m_file.writer);
+            configured = ConfigureWriterThread(m_sharedWriter) && configured;
+            for (auto& pipeline : m_sinkPipelines)
+            {
+                configured = ConfigureWriterThread(pipeline->writer) && configured;
+            }
+            m_trace.ConfigureWriter([this, &configured](std::thread& writer) {
+                configured = ConfigureWriterThread(writer) && configured;
+            });
+            return configured;
+        }
+
+        /**
+         * Apply the writer affinity and scheduling to one writer thread. Call with m_threadLock.
+         */
+        bool ConfigureWriterThread(std::thread& writer)
+        {
+            if (!writer.joinable())
+            {
+                return true;
+            }
+#ifndef WIN32
+            bool configured = true;
+#ifdef __linux__
+            if (!m_writerCpus.empty())
+            {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                for (auto cpu : m_writerCpus)
+                {
+                    if (cpu < 0 || cpu >= CPU_SETSIZE)
+                    {
+                        return false;
+                    }
+                    CPU_SET(static_cast<std::size_t>(cpu), &cpus);
+                }
+                configured = pthread_setaffinity_np(writer.native_handle(), sizeof(cpus), &cpus) == 0;
+            }
+#else
+            configured = m_writerCpus.empty();
+#endif
+            if (m_hasWriterScheduling)
+            {
+                sched_param param{};
+                param.sched_priority = m_writerPriority;
+                configured = pthread_setschedparam(writer.native_handle(), m_writerPolicy, &param) == 0 && configured;
+            }
+            return configured;
+#else
+            return m_writerCpus.empty() && !m_hasWriterScheduling;
+#endif
+        }
+
+        /**
+         * Write the batch a console or file writer has formatted but not written, see FlushFromSignalHandler().
+         * Sinks have no descriptor to write to, so they rely on their writers.
+         */
+        void WritePendingFromSignalHandler(LogPipeline& pipeline)
+        {
+#ifndef WIN32
+            auto size = pipeline.pendingSize.load(std::memory_order_acquire);
+            const char* data = pipeline.pendingData.load(std::memory_order_acquire);
+            int fd = &pipeline == &m_console ? STDOUT_FILENO : &pipeline == &m_file ? m_crashFd.load() : -1;
+            // The file's batch goes where the writer would have put it, over any part it did write
+            auto offset = static_cast<off_t>(m_fileEnd.load(std::memory_order_acquire));
+            while (size > 0 && data != nullptr && fd >= 0)
+            {
+                auto written = &pipeline == &m_file ? ::pwrite(fd, data, size, offset) : ::write(fd, data, size);
+                if (written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (written <= 0)
+                {
+                    return;
+                }
+                data += written;
+                size -= static_cast<std::size_t>(written);
+                offset += static_cast<off_t>(written);
+            }
+#else
+            (void)pipeline;
+#endif
+        }
+
+        /**
+         * Close the descriptor WritePendingFromSignalHandler() writes the log file with. Call with m_fstreamLock.
+         */
+        void CloseCrashFile()
+        {
+#ifndef WIN32
+            auto fd = m_crashFd.exchange(-1);
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+#endif
+        }
+
+        /**
+         * Collect the console, file and sink pipelines, returning how many there are
+         */
+        std::size_t Pipelines(std::array<LogPipeline*, LoggerMaxSinks + 2>& pipelines)
+        {
+            std::size_t count = 0;
+            pipelines[count++] = &m_console;
+            pipelines[count++] = &m_file;
+            auto sinks = m_sinkCount.load(std::memory_order_acquire);
+            for (std::size_t i = 0; i < sinks; ++i)
+            {
+                pipelines[count++] = m_sinks[i];
+            }
+            return count;
+        }
+
+        /**
+         * The named loggers, owned here and destroyed at exit
+         */
+        struct NamedLoggers
+        {
+            std::mutex lock{};
+            std::map<std::string, std::unique_ptr<SingleLog>> instances{};
+        };
+
+        static NamedLoggers& NamedInstances()
+        {
+            static NamedLoggers named;
+            return named;
+        }
+
+        /**
+         * Every live logger, default and named, linked through m_nextInstance so the crash handlers can walk them
+         * without taking a lock
+         */
+        struct InstanceList
+        {
+            std::mutex lock{};
+            std::atomic<SingleLog*> head{nullptr};
+        };
+
+        static InstanceList& Instances()
+        {
+            // Never destroyed, loggers unlink themselves during static destruction
+            static auto instances = new InstanceList();
+            return *instances;
+        }
+
+        void LinkInstance()
+        {
+            auto& instances = Instances();
+            std::lock_guard<std::mutex> lock(instances.lock);
+            m_nextInstance.store(instances.head.load());
+            instances.head.store(this);
+        }
+
+        void UnlinkInstance()
+        {
+            auto& instances = Instances();
+            std::lock_guard<std::mutex> lock(instances.lock);
+            for (auto link = &instances.head; link->load() != nullptr; link = &link->load()->m_nextInstance)
+            {
+                if (link->load() == this)
+                {
+                    link->store(m_nextInstance.load());
+                    return;
+                }
+            }
+        }
+
+        /**
+         * Level generations are unique across loggers, so a call site cache resolved for one logger never matches
+         * another's
+         */
+        static std::uint64_t NextLevelGeneration()
+        {
+            static std::atomic<std::uint64_t> generation{0};
+            return generation.fetch_add(1, std::memory_order_relaxed) + 1;
+        }
+
+        /**
+         * The fatal signals InstallCrashHandlers() handles and the handlers it replaced
+         */
+        struct CrashHandlers
+        {
+#ifdef WIN32
+            std::array<int, 4> signals{{SIGSEGV, SIGABRT, SIGILL, SIGFPE}};
+#else
+            std::array<int, 5> signals{{SIGSEGV, SIGABRT, SIGILL, SIGFPE, SIGBUS}};
+#endif
+            std::array<void (*)(int), std::tuple_size<decltype(signals)>::value> previous{};
+            std::terminate_handler previousTerminate{nullptr};
+            std::atomic<bool> installed{false};
+            std::atomic<bool> crashing{false};
+        };
+
+        static CrashHandlers& CrashState()
+        {
+            static CrashHandlers crash;
+            return crash;
+        }
+
+        static void OnFatalSignal(int signal)
+        {
+            auto& crash = CrashState();
+            // Flush once, a second crash while flushing goes straight to the previous handler
+            if (!crash.crashing.exchange(true))
+            {
+                for (auto instance = Instances().head.load(); instance != nullptr; instance = instance->m_nextInstance)
+                {
+                    instance->FlushFromSignalHandler(LoggerCrashFlushTimeout);
+                }
+            }
+            for (std::size_t i = 0; i < crash.signals.size(); ++i)
+            {
+                if (crash.signals[i] == signal)
+                {
+                    std::signal(signal, crash.previous[i] == SIG_ERR ? SIG_DFL : crash.previous[i]);
+                }
+            }
+            std::raise(signal);
+        }
+
+        static void OnTerminate()
         {
-            if (m_consoleLogLevel.load() <= level)
+            auto& crash = CrashState();
+            if (!crash.crashing.exchange(true))
             {
-                ConsoleLog(line);
+                for (auto instance = Instances().head.load(); instance != nullptr; instance = instance->m_nextInstance)
+                {
+                    instance->DumpFlightRecorder();
+                    instance->Flush(LoggerCrashFlushTimeout);
+                }
             }
-            if (m_fileLogLevel.load() <= level)
+            if (crash.previousTerminate != nullptr)
             {
-                FileLog(line);
+                crash.previousTerminate();
             }
+            std::abort();
         }
 
         /**
-         * Log TRACE level messages
+         * Mark a pipeline's flushes up to ticket as done and release the FlushAsync() calls waiting on them.
+         * The writer's last call, once it is finished, releases every flush. Writer thread only.
          */
-        void Trace(const std::string& _module, const std::string& _message)
+        static void CompleteFlushes(LogPipeline& pipeline, std::uint64_t ticket, bool finished)
         {
-            std::string level = "TRACE";
-            LogIt(LogLevel::L_TRACE, MakeLogLine(level, _module, _message));
+            std::vector<std::shared_ptr<FlushRequest>> done;
+            {
+                std::lock_guard<std::mutex> lock(pipeline.flushLock);
+                if (finished)
+                {
+                    // FlushAsync() checks exit under this lock, so no flush can be handed over after this
+                    ticket = pipeline.flushRequested.load();
+                }
+                pipeline.flushed.store(ticket, std::memory_order_release);
+                auto& waiters = pipeline.flushWaiters;
+                auto waiter = waiters.begin();
+                while (waiter != waiters.end())
+                {
+                    if (waiter->first <= ticket)
+                    {
+                        done.push_back(std::move(waiter->second));
+                        waiter = waiters.erase(waiter);
+                    }
+                    else
+                    {
+                        ++waiter;
+                    }
+                }
+            }
+            for (auto& request : done)
+            {
+                request->Release();
+            }
         }
 
         /**
-         * Log TRACE level messages
+         * Stop a pipeline's writer thread once it has written everything queued
          */
-        void Trace(const std::wstring& _module, const std::wstring& _message)
+        static void StopWriter(LogPipeline& pipeline)
         {
-            std::wstring level = L"TRACE";
-            LogIt(LogLevel::L_TRACE, MakeLogLine(level, _module, _message));
+            pipeline.exit.store(true);
+            pipeline.queue.Notify();
+            if (pipeline.writer.joinable())
+            {
+                pipeline.writer.join();
+            }
         }
 
         /**
-         * Log DEBUG level messages
+         * Allocate a pipeline's queue and give it its own writer thread, or with WriterThreads::Shared hand the queue
+         * to the shared writer. Call with m_threadLock before the pipeline receives any record.
          */
-        void Debug(const std::string& _module, const std::string& _message)
+        void StartWriter(LogPipeline& pipeline)
         {
-            std::string level = "DEBUG";
-            LogIt(LogLevel::L_DEBUG, MakeLogLine(level, _module, _message));
+            pipeline.queue.Allocate();
+            if (m_writerThreads.load() == WriterThreads::Shared)
+            {
+                pipeline.queue.ShareSignal(m_sharedSignal);
+                return;
+            }
+            pipeline.writer = std::thread(&SingleLog::PipelineWriter, this, std::ref(pipeline));
+            ConfigureWriterThread(pipeline.writer);
         }
 
-        /**
-         * Log DEBUG level messages
-         */
-        void Debug(const std::wstring& _module, const std::wstring& _message)
+        std::thread::id WriterThreadId(const LogPipeline& pipeline) const
         {
-            std::wstring level = L"DEBUG";
-            LogIt(LogLevel::L_DEBUG, MakeLogLine(level, _module, _message));
+            return m_writerThreads.load() == WriterThreads::Shared ? m_sharedWriter.get_id() : pipeline.writer.get_id();
         }
 
         /**
-         * Log INFO level messages
+         * One output's side of a writer thread. Run() drains everything queued and formats it into a single buffer,
+         * which is handed to write() in one call once it reaches the batch size or has waited for the maximum flush
+         * latency. A stream write this large goes straight to the OS, so each batch costs one lock and about one
+         * syscall. Messages discarded by the overflow policy are reported in the output at most once per
+         * LoggerDropReportInterval. settle() waits for writes an output completes asynchronously, before a flush
+         * is reported done.
          */
-        void Info(const std::string& _module, const std::string& _message)
+        class WriterTask
         {
-            std::string level = "INFO";
-            LogIt(LogLevel::L_INFO, MakeLogLine(level, _module, _message));
-        }
+        public:
+            explicit WriterTask(LogPipeline& pipeline) : m_pipeline(pipeline)
+            {
+            }
 
-        /**
-         * Log INFO level messages
-         */
-        void Info(const std::wstring& _module, const std::wstring& _message)
-        {
-            std::wstring level = L"INFO";
-            LogIt(LogLevel::L_INFO, MakeLogLine(level, _module, _message));
-        }
+            WriterTask(WriterTask const& copy) = delete;
+            WriterTask& operator=(WriterTask const& copy) = delete;
+            virtual ~WriterTask() = default;
 
-        /**
-         * Log NOTICE level messages
-         */
-        void Notice(const std::string& _module, const std::string& _message)
+            /**
+             * Drain the queue and write what is due. Returns true if anything was drained, in which case it should
+             * run again straight away.
+             */
+            virtual bool Run() = 0;
+
+            /**
+             * How long the writer may wait before Run() has something to do without new messages,
+             * nanoseconds::max() for as long as it takes
+             */
+            virtual std::chrono::nanoseconds Timeout() const = 0;
+
+            /**
+             * True when Run() has something to do
+             */
+            bool Ready() const
+            {
+                return m_pipeline.exit.load() || !m_pipeline.queue.Empty() ||
+                       m_pipeline.flushRequested.load(std::memory_order_acquire) !=
+                           m_pipeline.flushed.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * True once the pipeline has been stopped and everything queued has been written
+             */
+            bool Finished() const
+            {
+                return m_finished;
+            }
+
+        protected:
+            LogPipeline& m_pipeline;
+            bool m_finished{false};
+        };
+
+        template <typename Encode, typename Write, typename Settle>
+        class OutputWriter final : public WriterTask
         {
-            std::string level = "NOTICE";
-            LogIt(LogLevel::L_NOTICE, MakeLogLine(level, _module, _message));
-        }
+        public:
+            OutputWriter(SingleLog& owner, LogPipeline& pipeline, Encode encode, Write write, Settle settle)
+                : WriterTask(pipeline), m_owner(owner), m_encode(std::move(encode)), m_write(std::move(write)),
+                  m_settle(std::move(settle))
+            {
+                m_clock.Calibrate();
+            }
 
-        /**
-         * Log NOTICE level messages
-         */
-        void Notice(const std::wstring& _module, const std::wstring& _message)
+            bool Run() override
+            {
+                auto& queue = m_pipeline.queue;
+                auto& stats = m_pipeline.stats;
+                // Taken before draining, so the drain sees everything queued before the flush was asked for. The
+                // flush is done once the queue gets past where it was now, however much is logged meanwhile.
+                auto flushTicket = m_pipeline.flushRequested.load(std::memory_order_acquire);
+                if (flushTicket != m_flushTicket)
+                {
+                    m_flushTicket = flushTicket;
+                    m_flushPosition = queue.Position();
+                }
+                auto busySince = std::chrono::steady_clock::now();
+                bool drained = queue.Drain(m_batch);
+                if (drained)
+                {
+                    if (m_pending.empty())
+                    {
+                        m_pendingSince = std::chrono::steady_clock::now();
+                    }
+                    auto dequeued = m_clock.ToWallNanos(Clock::Now());
+                    for (const auto& record : m_batch)
+                    {
+                        stats.queueLatency.Record(dequeued - m_clock.ToWallNanos(record.Get().timestamp));
+                        m_encode(record, m_pending);
+                    }
+                    AddRelaxed(stats.written, m_batch.size());
+                    m_batch.clear();
+                }
+
+                bool finished = !drained && m_pipeline.exit.load();
+                auto dropped = queue.DroppedCount();
+                auto sinceDropReport = std::chrono::steady_clock::now() - m_lastDropReport;
+                if (dropped != m_droppedReported && (finished || sinceDropReport >= LoggerDropReportInterval))
+                {
+                    if (m_pending.empty())
+                    {
+                        m_pendingSince = std::chrono::steady_clock::now();
+                    }
+                    m_encode(QueuedRecord(MakeDropReport(dropped - m_droppedReported)), m_pending);
+                    m_droppedReported = dropped;
+                    m_lastDropReport = std::chrono::steady_clock::now();
+                }
+
+                m_pipeline.pendingSize.store(0, std::memory_order_relaxed);
+                m_pipeline.pendingData.store(m_pending.data(), std::memory_order_relaxed);
+                m_pipeline.pendingSize.store(m_pending.size(), std::memory_order_release);
+
+                auto latency = std::chrono::nanoseconds{m_owner.m_maxFlushLatency.load(std::memory_order_relaxed)};
+                auto waited = std::chrono::steady_clock::now() - m_pendingSince;
+                bool flushing = m_flushTicket != m_pipeline.flushed.load(std::memory_order_relaxed) &&
+                                queue.Reached(m_flushPosition);
+                if (!m_pending.empty() &&
+                    (finished || flushing ||
+                     m_pending.size() >= m_owner.m_writeBatchSize.load(std::memory_order_relaxed) || waited >= latency))
+                {
+                    auto writeStart = std::chrono::steady_clock::now();
+                    m_write(m_pending);
+                    stats.writeLatency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                  std::chrono::steady_clock::now() - writeStart)
+                                                  .count());
+                    AddRelaxed(stats.bytesWritten, m_pending.size());
+                    m_pipeline.pendingSize.store(0, std::memory_order_release);
+                    m_pending.clear();
+                }
+                if (flushing || finished)
+                {
+                    m_settle();
+                    CompleteFlushes(m_pipeline, m_flushTicket, finished);
+                }
+                AddRelaxed(stats.busyNanos, static_cast<std::uint64_t>(
+                                                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                    std::chrono::steady_clock::now() - busySince)
+                                                    .count()));
+                m_finished = finished;
+                return drained;
+            }
+
+            std::chrono::nanoseconds Timeout() const override
+            {
+                auto latency = std::chrono::nanoseconds{m_owner.m_maxFlushLatency.load(std::memory_order_relaxed)};
+                auto now = std::chrono::steady_clock::now();
+                if (m_pipeline.queue.DroppedCount() != m_droppedReported)
+                {
+                    // Wake up for the next drop report even if nothing else is logged
+                    std::chrono::nanoseconds timeout = LoggerDropReportInterval - (now - m_lastDropReport);
+                    if (!m_pending.empty())
+                    {
+                        timeout = std::min<std::chrono::nanoseconds>(timeout, latency - (now - m_pendingSince));
+                    }
+                    return timeout;
+                }
+                if (m_pending.empty())
+                {
+                    return std::chrono::nanoseconds::max();
+                }
+                return latency - (now - m_pendingSince);
+            }
+
+        private:
+            SingleLog& m_owner;
+            Encode m_encode;
+            Write m_write;
+            Settle m_settle;
+            Clock m_clock{};
+            std::vector<QueuedRecord> m_batch{};
+            std::string m_pending{};
+            std::chrono::steady_clock::time_point m_pendingSince{std::chrono::steady_clock::now()};
+            std::uint64_t m_droppedReported{0};
+            std::chrono::steady_clock::time_point m_lastDropReport{std::chrono::steady_clock::now() -
+                                                                   LoggerDropReportInterval};
+            std::uint64_t m_flushTicket{0};
+            std::size_t m_flushPosition{0};
+        };
+
+        template <typename Encode, typename Write, typename Settle>
+        std::unique_ptr<WriterTask> MakeWriterTask(LogPipeline& pipeline, Encode encode, Write write, Settle settle)
         {
-            std::wstring level = L"NOTICE";
-            LogIt(LogLevel::L_NOTICE, MakeLogLine(level, _module, _message));
+            return std::make_unique<OutputWriter<Encode, Write, Settle>>(*this, pipeline, std::move(encode),
+                                                                         std::move(write), std::move(settle));
         }
 
         /**
-         * Log WARNING level messages
+         * The writer task for the console, the file or a sink
          */
-        void Warning(const std::string& _module, const std::string& _message)
+        std::unique_ptr<WriterTask> WriterTaskFor(LogPipeline& pipeline)
         {
-            std::string level = "WARNING";
-            LogIt(LogLevel::L_WARNING, MakeLogLine(level, _module, _message));
+            if (&pipeline == &m_console)
+            {
+                return ConsoleTask();
+            }
+            if (&pipeline == &m_file)
+            {
+                return FileTask();
+            }
+            return SinkTask(pipeline);
         }
 
         /**
-         * Log WARNING level messages
+         * Write messages to the console.
          */
-        void Warning(const std::wstring& _module, const std::wstring& _message)
+        std::unique_ptr<WriterTask> ConsoleTask()
         {
-            std::wstring level = L"WARNING";
-            LogIt(LogLevel::L_WARNING, MakeLogLine(level, _module, _message));
+            auto encode = [this, encoder = TextEncoder()](const QueuedRecord& record, std::string& pending) mutable {
+                AppendText(record, m_console.format.load(std::memory_order_relaxed), encoder, pending);
+            };
+            auto write = [](const std::string& pending) {
+                std::cout.write(pending.data(), static_cast<std::streamsize>(pending.size()));
+                std::cout.flush();
+            };
+            return MakeWriterTask(m_console, std::move(encode), write, []() {});
         }
 
         /**
-         * Log ERROR level messages
+         * Write messages to a sink added with AddSink()
          */
-        void Error(const std::string& _module, const std::string& _message)
+        std::unique_ptr<WriterTask> SinkTask(LogPipeline& pipeline)
         {
-            std::string level = "ERROR";
-            LogIt(LogLevel::L_ERROR, MakeLogLine(level, _module, _message));
+            auto encode = [this, &pipeline, encoder = TextEncoder()](const QueuedRecord& record,
+                                                                    std::string& pending) mutable {
+                AppendText(record, pipeline.format.load(std::memory_order_relaxed), encoder, pending);
+            };
+            auto write = [&pipeline](const std::string& pending) { pipeline.sink->Write(pending); };
+            return MakeWriterTask(pipeline, std::move(encode), write, []() {});
         }
 
         /**
-         * Log ERROR level messages
+         * Write messages to the log file.
          */
-        void Error(const std::wstring& _module, const std::wstring& _message)
+        std::unique_ptr<WriterTask> FileTask()
         {
-            std::wstring level = L"ERROR";
-            LogIt(LogLevel::L_ERROR, MakeLogLine(level, _module, _message));
+            // The binary encoder's call sites are needed by both encode and write
+            struct FileEncoders
+            {
+                TextEncoder text{};
+                BinaryEncoder binary{};
+                std::uint64_t preambleGeneration{0};
+            };
+            auto encoders = std::make_shared<FileEncoders>();
+            auto encode = [this, encoders](const QueuedRecord& record, std::string& pending) {
+                auto format = m_activeFileFormat.load(std::memory_order_relaxed);
+                if (format == OutputFormat::Binary)
+                {
+                    encoders->binary.Append(record.Get(), pending);
+                }
+                else
+                {
+                    AppendText(record, format, encoders->text, pending);
+                }
+            };
+            auto write = [this, encoders](const std::string& pending) {
+                std::lock_guard<std::mutex> lock(m_fstreamLock);
+                if (m_activeFileFormat.load() == OutputFormat::Binary &&
+                    encoders->preambleGeneration != m_fileGeneration)
+                {
+                    // A new binary file needs the header and every call site pending may refer to
+                    std::string preamble;
+                    encoders->binary.AppendPreamble(preamble);
+                    WriteFile(preamble);
+                    m_fileEnd.store(m_fileEnd.load(std::memory_order_relaxed) + preamble.size());
+                    encoders->preambleGeneration = m_fileGeneration;
+                }
+                WriteFile(pending);
+                // Written, so a crash from here on must not write it again
+                m_file.pendingSize.store(0, std::memory_order_release);
+                m_fileEnd.store(m_fileEnd.load(std::memory_order_relaxed) + pending.size());
+            };
+            auto settle = [this]() {
+                std::lock_guard<std::mutex> lock(m_fstreamLock);
+                m_uringFile.Wait();
+                AddRelaxed(m_file.stats.writeErrors, m_uringFile.TakeWriteErrors());
+            };
+            return MakeWriterTask(m_file, std::move(encode), std::move(write), std::move(settle));
         }
 
         /**
-         * Log CRITICAL level messages
+         * Wait on a queue or the shared writer signal until ready() or timeout, with the configured wakeup policy
          */
-        void Critical(const std::string& _module, const std::string& _message)
+        template <typename Signal, typename Predicate>
+        void Park(Signal& signal, Predicate ready, std::chrono::nanoseconds timeout)
         {
-            std::string level = "CRITICAL";
-            LogIt(LogLevel::L_CRITICAL, MakeLogLine(level, _module, _message));
+            WriterWakeup wakeup{m_wakeupPolicy.load(std::memory_order_relaxed),
+                                m_writerSpinCount.load(std::memory_order_relaxed),
+                                std::chrono::nanoseconds{m_writerPollInterval.load(std::memory_order_relaxed)}};
+            if (CrashState().installed.load(std::memory_order_relaxed))
+            {
+                // No signal handler can wake a parked writer, so it looks for FlushFromSignalHandler() itself
+                timeout = std::min<std::chrono::nanoseconds>(timeout, LoggerCrashWakeInterval);
+            }
+            if (timeout == std::chrono::nanoseconds::max())
+            {
+                signal.Wait(ready, wakeup);
+            }
+            else
+            {
+                signal.WaitFor(ready, timeout, wakeup);
+            }
         }
 
         /**
-         * Log CRITICAL level messages
+         * Writer thread of one output
          */
-        void Critical(const std::wstring& _module, const std::wstring& _message)
+        void PipelineWriter(LogPipeline& pipeline)
         {
-            std::wstring level = L"CRITICAL";
-            LogIt(LogLevel::L_CRITICAL, MakeLogLine(level, _module, _message));
+            auto task = WriterTaskFor(pipeline);
+            while (true)
+            {
+                if (task->Run())
+                {
+                    continue;
+                }
+                if (task->Finished())
+                {
+                    break;
+                }
+                Park(pipeline.queue, [&task]() { return task->Ready(); }, task->Timeout());
+            }
         }
 
-    private:
         /**
-         * Create a common format log line
-         * Note: There might be a better way to produce UTF8 from ANSI text? This is "expensive".
+         * The one writer thread of WriterThreads::Shared, running the console, file and sink tasks in turn.
+         * Sinks added later are picked up as they are published.
          */
-        std::string MakeLogLine(const std::string& _level, const std::string& _module, const std::string& _message)
-        {
-            std::stringstream ss;
-            ss << "" << CurrentDateTime() << "  <" << _level << ">  " + _module + ":  " << _message << "\n";
-            return ss.str();
-        }
-
-        std::string MakeLogLine(const std::wstring& _level, const std::wstring& _module, const std::wstring& _message)
+        void SharedWriter()
         {
-            std::wstringstream ss;
-            ss << L"" << CurrentDateTimeW() << L"  <" << _level << L">  " + _module + L":  " << _message << L"\n";
-            return ToNarrow(ss.str());
+            std::vector<std::unique_ptr<WriterTask>> tasks;
+            tasks.push_back(WriterTaskFor(m_console));
+            tasks.push_back(WriterTaskFor(m_file));
+            auto ready = [this, &tasks]() {
+                return m_sinkCount.load(std::memory_order_acquire) + 2 != tasks.size() ||
+                       std::any_of(tasks.begin(), tasks.end(), [](const std::unique_ptr<WriterTask>& task) {
+                           return !task->Finished() && task->Ready();
+                       });
+            };
+            while (true)
+            {
+                auto sinks = m_sinkCount.load(std::memory_order_acquire);
+                while (tasks.size() < sinks + 2)
+                {
+                    tasks.push_back(WriterTaskFor(*m_sinks[tasks.size() - 2]));
+                }
+                bool drained = false;
+                bool finished = true;
+                auto timeout = std::chrono::nanoseconds::max();
+                for (auto& task : tasks)
+                {
+                    if (task->Finished())
+                    {
+                        continue;
+                    }
+                    drained = task->Run() || drained;
+                    if (!task->Finished())
+                    {
+                        finished = false;
+                        timeout = std::min(timeout, task->Timeout());
+                    }
+                }
+                if (drained)
+                {
+                    continue;
+                }
+                if (finished)
+                {
+                    break;
+                }
+                Park(m_sharedSignal, ready, timeout);
+            }
         }
 
         /**
-         * Log message to console deque
+         * Formatter state kept by each writer thread for AppendText()
          */
-        void ConsoleLog(std::string _s)
+        struct TextEncoder
         {
-            std::lock_guard<std::mutex> lock(m_consoleLogDequeLock);
-            m_consoleLogDeque.push_back(_s);
-            m_consoleCv.notify_one();
-        }
+            LineFormatter line{};
+            StructuredFormatter structured{};
+        };
 
         /**
-         * Log message to file deque
+         * Append a record in one of the text formats, anything other than Json and Logfmt as a text line
          */
-        void FileLog(std::string _s)
+        void AppendText(const QueuedRecord& record, OutputFormat format, TextEncoder& encoder, std::string& pending)
         {
-            std::lock_guard<std::mutex> lock(m_fstreamLogDequeLock);
-            m_fstreamLogDeque.push_back(_s);
-            m_fstreamCv.notify_one();
+            auto precision = m_timestampPrecision.load(std::memory_order_relaxed);
+            switch (format)
+            {
+            case OutputFormat::Json:
+            case OutputFormat::Logfmt:
+                encoder.structured.Append(record.Get(), format, precision, pending);
+                break;
+            case OutputFormat::Text:
+            case OutputFormat::Binary:
+            default:
+                pending += record.Line(encoder.line, precision);
+                break;
+            }
         }
 
         /**
-         * Write messages to the console.
+         * Write to whichever log file is open. Call with m_fstreamLock.
          */
-        void ConsoleWriter()
+        void WriteFile(const std::string& data)
         {
-            while (true)
+            if (m_mappedFile.IsOpen())
+            {
+                m_mappedFile.Write(data.data(), data.size());
+            }
+            else if (m_uringFile.IsOpen())
+            {
+                m_uringFile.Write(data.data(), data.size());
+                AddRelaxed(m_file.stats.writeErrors, m_uringFile.TakeWriteErrors());
+            }
+            else if (m_fileOut.is_open())
             {
-                std::string s;
+                m_fileOut.write(data.data(), static_cast<std::streamsize>(data.size()));
+                m_fileOut.flush();
+                if (!m_fileOut)
                 {
-                    std::unique_lock<std::mutex> lock(m_consoleLogDequeLock);
-                    m_consoleCv.wait(lock, [this]() { return m_consoleExit || !m_consoleLogDeque.empty(); });
-                    if (m_consoleExit && m_consoleLogDeque.empty())
-                    {
-                        break;
-                    }
-                    s = m_consoleLogDeque.front();
-                    m_consoleLogDeque.pop_front();
+                    AddRelaxed(m_file.stats.writeErrors, 1);
+                    m_fileOut.clear();
                 }
-                std::cout << s;
             }
         }
 
         /**
-         * Write messages to the log file.
+         * Add to a counter that only the calling writer thread updates, a plain load and store is enough
          */
-        void FstreamWriter()
+        static void AddRelaxed(std::atomic<std::uint64_t>& counter, std::uint64_t value)
         {
-            while (true)
-            {
-                std::string s;
-                {
-                    std::unique_lock<std::mutex> lock(m_fstreamLogDequeLock);
-                    m_fstreamCv.wait(lock, [this]() { return m_fstreamExit || !m_fstreamLogDeque.empty(); });
-                    if (m_fstreamExit && m_fstreamLogDeque.empty())
-                    {
-                        break;
-                    }
-                    s = m_fstreamLogDeque.front();
-                    m_fstreamLogDeque.pop_front();
-                }
-                std::lock_guard<std::mutex> lock(m_fstreamLock);
-                if (m_fileOut.is_open())
-                {
-                    m_fileOut << s;
-                }
-            }
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        /**
+         * The "N messages dropped" record written by the writers
+         */
+        static LogRecord MakeDropReport(std::uint64_t dropped)
+        {
+            LogRecord record{};
+            record.timestamp = Clock::Now();
+            record.threadId = CurrentThreadId();
+            record.kind = RecordKind::Message;
+            record.level = LogLevel::L_WARNING;
+            record.module = "SingleLog";
+            auto text = std::to_string(dropped) + (dropped == 1 ? " message dropped" : " messages dropped");
+            record.text.assign(text.data(), text.size());
+            return record;
         }
 
-        std::atomic<LogLevel> m_consoleLogLevel{LogLevel::L_INFO};
-        std::atomic<LogLevel> m_fileLogLevel{LogLevel::L_TRACE};
+        std::string m_name{};
+        std::atomic<SingleLog*> m_nextInstance{nullptr};
+        std::atomic<LogLevel> m_minimumLogLevel{LogLevel::L_TRACE};
+        std::atomic<TimestampPrecision> m_timestampPrecision{TimestampPrecision::Seconds};
+        std::atomic<std::size_t> m_writeBatchSize{LoggerWriteBatchSize};
+        std::atomic<std::int64_t> m_maxFlushLatency{0};
+        std::atomic<WakeupPolicy> m_wakeupPolicy{WakeupPolicy::Park};
+        std::atomic<std::uint32_t> m_writerSpinCount{LoggerWriterSpinCount};
+        std::atomic<std::int64_t> m_writerPollInterval{
+            std::chrono::duration_cast<std::chrono::nanoseconds>(LoggerWriterPollInterval).count()};
+        std::mutex m_threadLock{};
+        std::vector<int> m_writerCpus{};
+        bool m_hasWriterScheduling{false};
+        int m_writerPolicy{0};
+        int m_writerPriority{0};
+        std::mutex m_levelLock{};
+        std::atomic<std::uint64_t> m_levelGeneration{NextLevelGeneration()};
+        std::atomic<bool> m_hasModuleLevels{false};
+        std::vector<std::pair<std::string, LogLevel>> m_moduleLevels{};
+        std::atomic<FileSinkMode> m_fileSinkMode{FileSinkMode::Stream};
+        std::atomic<OutputFormat> m_fileOutputFormat{OutputFormat::Text};
+        std::atomic<OutputFormat> m_activeFileFormat{OutputFormat::Text};
+        std::uint64_t m_fileGeneration{0};
+        // Where the writer's next batch goes in the log file, and a descriptor to write it with from a crash
+        std::atomic<std::size_t> m_fileEnd{0};
+        std::atomic<int> m_crashFd{-1};
         std::ofstream m_fileOut{};
+        MappedFile m_mappedFile{};
+        UringFile m_uringFile{};
         std::string m_filePath{};
         std::array<char, LogggerInternalBufferSize> m_writeBuffer{0};
 
-        std::mutex m_consoleLogDequeLock{};
-        std::mutex m_fstreamLogDequeLock{};
         std::mutex m_fstreamLock{};
-        std::condition_variable m_consoleCv{};
-        std::condition_variable m_fstreamCv{};
 
-        std::deque<std::string> m_consoleLogDeque{};
-        std::deque<std::string> m_fstreamLogDeque{};
+        LogPipeline m_console{LogLevel::L_TRACE};
+        LogPipeline m_file{LogLevel::L_TRACE};
+
+        // Sinks are only ever added, m_sinks[0, m_sinkCount) can be read without m_sinkLock
+        std::mutex m_sinkLock{};
+        std::array<LogPipeline*, LoggerMaxSinks> m_sinks{};
+        std::atomic<std::size_t> m_sinkCount{0};
+        std::vector<std::unique_ptr<LogPipeline>> m_sinkPipelines{};
+        std::atomic<QueueMode> m_queueMode{QueueMode::Shared};
+        std::atomic<WriterThreads> m_writerThreads{WriterThreads::PerOutput};
+        std::atomic<bool> m_writersStarted{false};
+        std::atomic<LogLevel> m_flightRecorderLevel{LogLevel::L_OFF};
+        std::atomic<LogLevel> m_flightRecorderTrigger{LogLevel::L_ERROR};
+        FlightRecorder m_flightRecorder{};
+        WriterSignal m_sharedSignal{};
+        std::thread m_sharedWriter{};
+
+        TraceRecorder m_trace{};
+    };
 
-        bool m_consoleExit{false};
-        bool m_fstreamExit{false};
+    /**
+     * The resolved level for one call site of the LOG_* macros, held in a static there. The level is packed with
+     * the logger's level generation it was resolved at into one atomic, and only looked up again once a level has
+     * changed, so a call site's check is a load and compare rather than a match against the module levels.
+     */
+    class CallSiteLevel final
+    {
+    public:
+        bool Enabled(SingleLog& logger, LogLevel level, const char* _module)
+        {
+            auto generation = logger.LevelGeneration();
+            auto state = m_state.load(std::memory_order_relaxed);
+            if (state >> 16 != generation)
+            {
+                // Read the generation before resolving, a change made meanwhile is caught by the next call
+                state = generation << 16 | static_cast<std::uint64_t>(logger.ModuleLogLevel(_module));
+                m_state.store(state, std::memory_order_relaxed);
+            }
+            return static_cast<std::uint64_t>(level) >= (state & 0xFFFF);
+        }
 
-        std::thread m_consoleWriter{};
-        std::thread m_fstreamWriter{};
+    private:
+        std::atomic<std::uint64_t> m_state{0};
     };
 
 }; // namespace Logging
 
 namespace
 {
-    auto& g_globalSingleLogInstanceRef{Uplinkzero::Logging::SingleLog::GetInstance()};
-
+    /**
+     * The scope guard behind LOG_FUNCTION_TRACE. While a trace file is recorded it takes the entry and exit ticks
+     * for the trace, otherwise it logs entering and exiting TRACE messages if that level is enabled.
+     */
     class FunctionTrace final
     {
     public:
-        explicit FunctionTrace(const std::string& functionName) : m_functionName{functionName}
+        explicit FunctionTrace(const Uplinkzero::Logging::TraceSite& site)
+            : m_logger(Uplinkzero::Logging::SingleLog::GetInstance()), m_site(site)
         {
-            std::stringstream ss;
-            ss << ">>> Entering: " << m_functionName;
-            g_globalSingleLogInstanceRef.Trace("FunctionTrace", ss.str());
+            if (m_logger.IsTracing())
+            {
+                m_mode = Mode::Span;
+                m_begin = Uplinkzero::Logging::Clock::Now();
+            }
+            else if (m_logger.IsEnabled(Uplinkzero::Logging::LogLevel::L_TRACE))
+            {
+                m_mode = Mode::Message;
+                m_logger.LogFormat(Uplinkzero::Logging::LogLevel::L_TRACE, "FunctionTrace", ">>> Entering: %s",
+                                   m_site.function);
+            }
         }
 
+        FunctionTrace(FunctionTrace const& copy) = delete;
+        FunctionTrace& operator=(FunctionTrace const& copy) = delete;
+
         ~FunctionTrace()
         {
-            std::stringstream ss;
-            ss << "<<< Exiting: " << m_functionName;
-            g_globalSingleLogInstanceRef.Trace("FunctionTrace", ss.str());
+            if (m_mode == Mode::Span)
+            {
+                m_logger.RecordTrace(m_site, m_begin, Uplinkzero::Logging::Clock::Now());
+            }
+            else if (m_mode == Mode::Message)
+            {
+                m_logger.LogFormat(Uplinkzero::Logging::LogLevel::L_TRACE, "FunctionTrace", "<<< Exiting: %s",
+                                   m_site.function);
+            }
         }
 
     private:
-        std::string m_functionName;
+        enum class Mode
+        {
+            Off,
+            Span,
+            Message
+        };
+
+        Uplinkzero::Logging::SingleLog& m_logger;
+        const Uplinkzero::Logging::TraceSite& m_site;
+        Mode m_mode{Mode::Off};
+        std::uint64_t m_begin{0};
     };
 } // namespace
 
-namespace StringTools
-{
-    template <typename... Args>
-    std::string string_format(const std::string& format, Args&&... args)
-    {
-        auto size = std::snprintf(nullptr, 0, format.c_str(), std::forward<Args>(args)...) + 1; // Extra space for '\0'
-        if (size < 0)
-        {
-            return {};
-        }
-        std::unique_ptr<char[]> buffer = std::make_unique<char[]>(static_cast<size_t>(size));
-        std::snprintf(buffer.get(), static_cast<size_t>(size), format.c_str(), std::forward<Args>(args)...);
-        return std::string(buffer.get(), buffer.get() + size - 1); // We don't want the '\0' inside
-    }
-} // namespace StringTools
+/**
+ * Compile time threshold. Call sites below SINGLELOG_ACTIVE_LEVEL are removed entirely, e.g. build release binaries
+ * with -DSINGLELOG_ACTIVE_LEVEL=SINGLELOG_LEVEL_INFO to drop LOG_TRACE, LOG_DEBUG and LOG_FUNCTION_TRACE.
+ */
+#define SINGLELOG_LEVEL_TRACE 100
+#define SINGLELOG_LEVEL_DEBUG 200
+#define SINGLELOG_LEVEL_INFO 300
+#define SINGLELOG_LEVEL_NOTICE 400
+#define SINGLELOG_LEVEL_WARNING 500
+#define SINGLELOG_LEVEL_ERROR 600
+#define SINGLELOG_LEVEL_CRITICAL 700
+#define SINGLELOG_LEVEL_OFF 1000
+
+#ifndef SINGLELOG_ACTIVE_LEVEL
+#define SINGLELOG_ACTIVE_LEVEL SINGLELOG_LEVEL_TRACE
+#endif
+
+static_assert(SINGLELOG_LEVEL_TRACE == static_cast<int>(Logging::LogLevel::L_TRACE), "Level mismatch");
+static_assert(SINGLELOG_LEVEL_DEBUG == static_cast<int>(Logging::LogLevel::L_DEBUG), "Level mismatch");
+static_assert(SINGLELOG_LEVEL_INFO == static_cast<int>(Logging::LogLevel::L_INFO), "Level mismatch");
+static_assert(SINGLELOG_LEVEL_NOTICE == static_cast<int>(Logging::LogLevel::L_NOTICE), "Level mismatch");
+static_assert(SINGLELOG_LEVEL_WARNING == static_cast<int>(Logging::LogLevel::L_WARNING), "Level mismatch");
+static_assert(SINGLELOG_LEVEL_ERROR == static_cast<int>(Logging::LogLevel::L_ERROR), "Level mismatch");
+static_assert(SINGLELOG_LEVEL_CRITICAL == static_cast<int>(Logging::LogLevel::L_CRITICAL), "Level mismatch");
 
-#define LOG_FUNCTION_TRACE Uplinkzero::FunctionTrace tr(__func__);
+/**
+ * The logger the LOG_* macros write to, created on first use rather than during static initialisation
+ */
+#define SINGLELOG_DEFAULT_LOGGER Uplinkzero::Logging::SingleLog::GetInstance()
 
-#define LOG_TRACE(message) Uplinkzero::g_globalSingleLogInstanceRef.Trace(__func__, message);
+/**
+ * Call logger.function(LevelChecked{}, level, __func__, ...) if LEVEL is enabled in logger for the calling function,
+ * checked through a CallSiteLevel cached at the call site. Levels below SINGLELOG_ACTIVE_LEVEL compile to nothing.
+ * Every logging macro expands to one do { } while (false) statement, so each can be used like a function call.
+ */
+#define SINGLELOG_LOGGER_CALL_SITE(logger, LEVEL, function, ...)                                                       \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (SINGLELOG_LEVEL_##LEVEL >= SINGLELOG_ACTIVE_LEVEL)                                                         \
+        {                                                                                                              \
+            static Uplinkzero::Logging::CallSiteLevel singlelogCallSite;                                               \
+            Uplinkzero::Logging::SingleLog& singlelogLogger = logger;                                                  \
+            if (singlelogCallSite.Enabled(singlelogLogger, Uplinkzero::Logging::LogLevel::L_##LEVEL, __func__))        \
+            {                                                                                                          \
+                singlelogLogger.function(Uplinkzero::Logging::LevelChecked{},                                          \
+                                         Uplinkzero::Logging::LogLevel::L_##LEVEL, __func__, __VA_ARGS__);             \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (false)
 
-#define LOG_DEBUG(message) Uplinkzero::g_globalSingleLogInstanceRef.Debug(__func__, message);
+#define SINGLELOG_CALL_SITE(LEVEL, function, ...)                                                                      \
+    SINGLELOG_LOGGER_CALL_SITE(SINGLELOG_DEFAULT_LOGGER, LEVEL, function, __VA_ARGS__)
 
-#define LOG_INFO(message) Uplinkzero::g_globalSingleLogInstanceRef.Info(__func__, message);
+#if SINGLELOG_ACTIVE_LEVEL <= SINGLELOG_LEVEL_TRACE
+#define LOG_FUNCTION_TRACE                                                                                             \
+    static const Uplinkzero::Logging::TraceSite singlelogTraceSite{__func__, __FILE__, __LINE__};                      \
+    Uplinkzero::FunctionTrace singlelogFunctionTrace(singlelogTraceSite);
 
-#define LOG_NOTICE(message) Uplinkzero::g_globalSingleLogInstanceRef.Notice(__func__, message);
+#define LOG_TRACE(message) SINGLELOG_CALL_SITE(TRACE, LogMessage, message)
 
-#define LOG_WARNING(message) Uplinkzero::g_globalSingleLogInstanceRef.Warning(__func__, message);
+#define LOGF_TRACE(format, ...) SINGLELOG_CALL_SITE(TRACE, LogFormat, format, __VA_ARGS__)
 
-#define LOG_ERROR(message) Uplinkzero::g_globalSingleLogInstanceRef.Error(__func__, message);
+#define LOG_TRACE_KV(...) SINGLELOG_CALL_SITE(TRACE, LogFields, "" __VA_ARGS__)
+#else
+#define LOG_FUNCTION_TRACE
+#define LOG_TRACE(message) static_cast<void>(0)
+#define LOGF_TRACE(format, ...) static_cast<void>(0)
+#define LOG_TRACE_KV(...) static_cast<void>(0)
+#endif
+
+#if SINGLELOG_ACTIVE_LEVEL <= SINGLELOG_LEVEL_DEBUG
+#define LOG_DEBUG(message) SINGLELOG_CALL_SITE(DEBUG, LogMessage, message)
+
+#define LOGF_DEBUG(format, ...) SINGLELOG_CALL_SITE(DEBUG, LogFormat, format, __VA_ARGS__)
+
+#define LOG_DEBUG_KV(...) SINGLELOG_CALL_SITE(DEBUG, LogFields, "" __VA_ARGS__)
+#else
+#define LOG_DEBUG(message) static_cast<void>(0)
+#define LOGF_DEBUG(format, ...) static_cast<void>(0)
+#define LOG_DEBUG_KV(...) static_cast<void>(0)
+#endif
+
+#if SINGLELOG_ACTIVE_LEVEL <= SINGLELOG_LEVEL_INFO
+#define LOG_INFO(message) SINGLELOG_CALL_SITE(INFO, LogMessage, message)
+
+#define LOGF_INFO(format, ...) SINGLELOG_CALL_SITE(INFO, LogFormat, format, __VA_ARGS__)
+
+#define LOG_INFO_KV(...) SINGLELOG_CALL_SITE(INFO, LogFields, "" __VA_ARGS__)
+#else
+#define LOG_INFO(message) static_cast<void>(0)
+#define LOGF_INFO(format, ...) static_cast<void>(0)
+#define LOG_INFO_KV(...) static_cast<void>(0)
+#endif
+
+#if SINGLELOG_ACTIVE_LEVEL <= SINGLELOG_LEVEL_NOTICE
+#define LOG_NOTICE(message) SINGLELOG_CALL_SITE(NOTICE, LogMessage, message)
+
+#define LOGF_NOTICE(format, ...) SINGLELOG_CALL_SITE(NOTICE, LogFormat, format, __VA_ARGS__)
+
+#define LOG_NOTICE_KV(...) SINGLELOG_CALL_SITE(NOTICE, LogFields, "" __VA_ARGS__)
+#else
+#define LOG_NOTICE(message) static_cast<void>(0)
+#define LOGF_NOTICE(format, ...) static_cast<void>(0)
+#define LOG_NOTICE_KV(...) static_cast<void>(0)
+#endif
+
+#if SINGLELOG_ACTIVE_LEVEL <= SINGLELOG_LEVEL_WARNING
+#define LOG_WARNING(message) SINGLELOG_CALL_SITE(WARNING, LogMessage, message)
+
+#define LOGF_WARNING(format, ...) SINGLELOG_CALL_SITE(WARNING, LogFormat, format, __VA_ARGS__)
+
+#define LOG_WARNING_KV(...) SINGLELOG_CALL_SITE(WARNING, LogFields, "" __VA_ARGS__)
+#else
+#define LOG_WARNING(message) static_cast<void>(0)
+#define LOGF_WARNING(format, ...) static_cast<void>(0)
+#define LOG_WARNING_KV(...) static_cast<void>(0)
+#endif
+
+#if SINGLELOG_ACTIVE_LEVEL <= SINGLELOG_LEVEL_ERROR
+#define LOG_ERROR(message) SINGLELOG_CALL_SITE(ERROR, LogMessage, message)
+
+#define LOGF_ERROR(format, ...) SINGLELOG_CALL_SITE(ERROR, LogFormat, format, __VA_ARGS__)
 
-#define LOG_CRITICAL(message) Uplinkzero::g_globalSingleLogInstanceRef.Critical(__func__, message);
+#define LOG_ERROR_KV(...) SINGLELOG_CALL_SITE(ERROR, LogFields, "" __VA_ARGS__)
+#else
+#define LOG_ERROR(message) static_cast<void>(0)
+#define LOGF_ERROR(format, ...) static_cast<void>(0)
+#define LOG_ERROR_KV(...) static_cast<void>(0)
+#endif
+
+#if SINGLELOG_ACTIVE_LEVEL <= SINGLELOG_LEVEL_CRITICAL
+#define LOG_CRITICAL(message) SINGLELOG_CALL_SITE(CRITICAL, LogMessage, message)
+
+#define LOGF_CRITICAL(format, ...) SINGLELOG_CALL_SITE(CRITICAL, LogFormat, format, __VA_ARGS__)
 
-#define LOGF_TRACE(format, ...)                                                                                        \
-    Uplinkzero::g_globalSingleLogInstanceRef.Trace(__func__,                                                           \
-                                                   Uplinkzero::StringTools::string_format(format, __VA_ARGS__));
+#define LOG_CRITICAL_KV(...) SINGLELOG_CALL_SITE(CRITICAL, LogFields, "" __VA_ARGS__)
+#else
+#define LOG_CRITICAL(message) static_cast<void>(0)
+#define LOGF_CRITICAL(format, ...) static_cast<void>(0)
+#define LOG_CRITICAL_KV(...) static_cast<void>(0)
+#endif
 
-#define LOGF_DEBUG(format, ...)                                                                                        \
-    Uplinkzero::g_globalSingleLogInstanceRef.Debug(__func__,                                                           \
-                                                   Uplinkzero::StringTools::string_format(format, __VA_ARGS__));
+#if SINGLELOG_HAS_STD_FORMAT
+/**
+ * std::format style logging, e.g. LOGFMT_INFO("{} took {:.3f} ms", name, elapsed). Mismatched arguments are a
+ * compile error. Like LOG_*, levels below SINGLELOG_ACTIVE_LEVEL compile to nothing.
+ */
+#define SINGLELOG_STD_FORMAT(LEVEL, ...) SINGLELOG_CALL_SITE(LEVEL, LogStdFormat, __VA_ARGS__)
 
-#define LOGF_INFO(format, ...)                                                                                         \
-    Uplinkzero::g_globalSingleLogInstanceRef.Info(__func__,                                                            \
-                                                  Uplinkzero::StringTools::string_format(format, __VA_ARGS__));
+#define LOGFMT_TRACE(...) SINGLELOG_STD_FORMAT(TRACE, __VA_ARGS__)
+#define LOGFMT_DEBUG(...) SINGLELOG_STD_FORMAT(DEBUG, __VA_ARGS__)
+#define LOGFMT_INFO(...) SINGLELOG_STD_FORMAT(INFO, __VA_ARGS__)
+#define LOGFMT_NOTICE(...) SINGLELOG_STD_FORMAT(NOTICE, __VA_ARGS__)
+#define LOGFMT_WARNING(...) SINGLELOG_STD_FORMAT(WARNING, __VA_ARGS__)
+#define LOGFMT_ERROR(...) SINGLELOG_STD_FORMAT(ERROR, __VA_ARGS__)
+#define LOGFMT_CRITICAL(...) SINGLELOG_STD_FORMAT(CRITICAL, __VA_ARGS__)
+#endif
 
-#define LOGF_NOTICE(format, ...)                                                                                       \
-    Uplinkzero::g_globalSingleLogInstanceRef.Notice(__func__,                                                          \
-                                                    Uplinkzero::StringTools::string_format(format, __VA_ARGS__));
+/**
+ * Logging to a named logger, e.g. LOG_TO(audit, WARNING, message) with auto& audit = SingleLog::GetInstance("audit").
+ * LEVEL is TRACE, DEBUG, INFO, NOTICE, WARNING, ERROR or CRITICAL, the rest are as for LOG_*, LOGF_*, LOG_*_KV and
+ * LOGFMT_*. Levels below SINGLELOG_ACTIVE_LEVEL compile to nothing.
+ */
+#define SINGLELOG_TO(logger, LEVEL, function, ...) SINGLELOG_LOGGER_CALL_SITE(logger, LEVEL, function, __VA_ARGS__)
 
-#define LOGF_WARNING(format, ...)                                                                                      \
-    Uplinkzero::g_globalSingleLogInstanceRef.Warning(__func__,                                                         \
-                                                     Uplinkzero::StringTools::string_format(format, __VA_ARGS__));
+#define LOG_TO(logger, LEVEL, message) SINGLELOG_TO(logger, LEVEL, LogMessage, message)
+#define LOGF_TO(logger, LEVEL, format, ...) SINGLELOG_TO(logger, LEVEL, LogFormat, format, __VA_ARGS__)
+#define LOG_KV_TO(logger, LEVEL, ...) SINGLELOG_TO(logger, LEVEL, LogFields, "" __VA_ARGS__)
+#if SINGLELOG_HAS_STD_FORMAT
+#define LOGFMT_TO(logger, LEVEL, ...) SINGLELOG_TO(logger, LEVEL, LogStdFormat, __VA_ARGS__)
+#endif
 
-#define LOGF_ERROR(format, ...)                                                                                        \
-    Uplinkzero::g_globalSingleLogInstanceRef.Error(__func__,                                                           \
-                                                   Uplinkzero::StringTools::string_format(format, __VA_ARGS__));
+/**
+ * Rate limited logging, each call site keeps its own state. LEVEL is TRACE, DEBUG, INFO, NOTICE, WARNING, ERROR or
+ * CRITICAL, and the LOGF_ forms take a format and its arguments in place of message.
+ * LOG_EVERY_N(INFO, 100, message): the 1st, 101st, 201st... call
+ * LOG_FIRST_N(WARNING, 10, message): the first 10 calls
+ * LOG_EVERY_MS(ERROR, 1000, message): at most one call a second
+ * LOG_RATE_LIMITED(ERROR, 5, 20, message): bursts of up to 20 calls, refilled at 5 a second
+ * How many messages LOG_EVERY_MS and LOG_RATE_LIMITED held back is logged when the next one gets through.
+ * Calls at a level disabled for the calling function, globally or by SetModuleLogLevel(), do not count towards
+ * the limit.
+ */
+#define SINGLELOG_LIMITED(LEVEL, check, statement)                                                                     \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        static Uplinkzero::Logging::CallSiteLevel singlelogLimitedSite;                                                \
+        static Uplinkzero::Logging::CallSiteLimiter singlelogLimiter;                                                  \
+        if (SINGLELOG_LEVEL_##LEVEL >= SINGLELOG_ACTIVE_LEVEL &&                                                       \
+            singlelogLimitedSite.Enabled(SINGLELOG_DEFAULT_LOGGER, Uplinkzero::Logging::LogLevel::L_##LEVEL,           \
+                                         __func__) &&                                                                  \
+            singlelogLimiter.check)                                                                                    \
+        {                                                                                                              \
+            SINGLELOG_DEFAULT_LOGGER.LogSuppressed(Uplinkzero::Logging::LogLevel::L_##LEVEL, __func__,                 \
+                                                   singlelogLimiter.TakeSuppressed());                                 \
+            statement;                                                                                                 \
+        }                                                                                                              \
+    } while (false)
 
-#define LOGF_CRITICAL(format, ...)                                                                                     \
-    Uplinkzero::g_globalSingleLogInstanceRef.Critical(__func__,                                                        \
-                                                      Uplinkzero::StringTools::string_format(format, __VA_ARGS__));
+#define LOG_EVERY_N(LEVEL, n, message) SINGLELOG_LIMITED(LEVEL, EveryN(n), LOG_##LEVEL(message))
+#define LOGF_EVERY_N(LEVEL, n, format, ...) SINGLELOG_LIMITED(LEVEL, EveryN(n), LOGF_##LEVEL(format, __VA_ARGS__))
+#define LOG_FIRST_N(LEVEL, n, message) SINGLELOG_LIMITED(LEVEL, FirstN(n), LOG_##LEVEL(message))
+#define LOGF_FIRST_N(LEVEL, n, format, ...) SINGLELOG_LIMITED(LEVEL, FirstN(n), LOGF_##LEVEL(format, __VA_ARGS__))
+#define LOG_EVERY_MS(LEVEL, ms, message) SINGLELOG_LIMITED(LEVEL, EveryMs(ms), LOG_##LEVEL(message))
+#define LOGF_EVERY_MS(LEVEL, ms, format, ...) SINGLELOG_LIMITED(LEVEL, EveryMs(ms), LOGF_##LEVEL(format, __VA_ARGS__))
+#define LOG_RATE_LIMITED(LEVEL, perSecond, burst, message)                                                             \
+    SINGLELOG_LIMITED(LEVEL, RateLimited(perSecond, burst), LOG_##LEVEL(message))
+#define LOGF_RATE_LIMITED(LEVEL, perSecond, burst, format, ...)                                                        \
+    SINGLELOG_LIMITED(LEVEL, RateLimited(perSecond, burst), LOGF_##LEVEL(format, __VA_ARGS__))
 
 }; // namespace Uplinkzero
@@ -0,0 +1,319 @@
+// Copyright(c) 2016-2026, James Chapman
+//
+// Use of this source code is governed by a BSD -
+// style license that can be found in the LICENSE file or
+// at https://choosealicense.com/licenses/bsd-3-clause/
+
+// Latency and throughput benchmarks for SingleLog, results are written to stdout as JSON.
+//
+// Usage: singlelog-bench [--iterations N] [--threads N] [--log-file path]
+
+#include "SingleLog.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using namespace Uplinkzero::Logging;
+    using BenchClock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        std::size_t iterations{200000};
+        std::size_t threads{0};
+        std::string logFile{"singlelog-bench.log"};
+    };
+
+    std::int64_t ElapsedNanos(BenchClock::time_point start, BenchClock::time_point end)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+
+    /**
+     * Percentiles of a set of samples in nanoseconds, as a JSON object
+     */
+    std::string Histogram(std::vector<std::int64_t>& samples)
+    {
+        std::sort(samples.begin(), samples.end());
+        auto at = [&samples](double percentile) {
+            auto index = static_cast<std::size_t>(percentile * static_cast<double>(samples.size() - 1));
+            return samples[index];
+        };
+        std::int64_t total = 0;
+        for (auto sample : samples)
+        {
+            total += sample;
+        }
+        std::ostringstream json;
+        json << "{\"samples\": " << samples.size()
+             << ", \"mean_ns\": " << total / static_cast<std::int64_t>(samples.size())
+             << ", \"p50_ns\": " << at(0.5) << ", \"p99_ns\": " << at(0.99) << ", \"p99_9_ns\": " << at(0.999)
+             << ", \"max_ns\": " << samples.back() << "}";
+        return json.str();
+    }
+
+    /**
+     * Time each call of log() on its own
+     */
+    template <typename Log>
+    std::string MeasureLatency(std::size_t iterations, Log log)
+    {
+        std::vector<std::int64_t> samples;
+        samples.reserve(iterations);
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            auto start = BenchClock::now();
+            log(i);
+            auto end = BenchClock::now();
+            samples.push_back(ElapsedNanos(start, end));
+        }
+        return Histogram(samples);
+    }
+
+    /**
+     * Average cost of calls that are filtered out by level, the loop is timed as a whole
+     */
+    template <typename Log>
+    double MeasureDisabled(std::size_t iterations, Log log)
+    {
+        auto start = BenchClock::now();
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            log(i);
+        }
+        auto end = BenchClock::now();
+        return static_cast<double>(ElapsedNanos(start, end)) / static_cast<double>(iterations);
+    }
+
+    std::uint64_t FileSize(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        auto size = file.tellg();
+        return size < 0 ? 0 : static_cast<std::uint64_t>(size);
+    }
+
+    /**
+     * True once the log file ends with text
+     */
+    bool FileEndsWith(const std::string& path, const std::string& text)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        auto size = file.tellg();
+        if (size < static_cast<std::streamoff>(text.size()))
+        {
+            return false;
+        }
+        file.seekg(size - static_cast<std::streamoff>(text.size()));
+        std::string tail(text.size(), '\0');
+        file.read(&tail[0], static_cast<std::streamsize>(tail.size()));
+        return tail == text;
+    }
+
+    /**
+     * Log a marker and wait until the file writer has written it, everything queued before it is then on disk
+     */
+    void WaitForWriter(const std::string& path, const std::string& marker)
+    {
+        LOG_CRITICAL(marker);
+        while (!FileEndsWith(path, marker + "\n"))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * Time from logging a message until the file writer has written it, one message at a time
+     */
+    std::string MeasureEndToEnd(const std::string& path, std::size_t iterations)
+    {
+        std::vector<std::int64_t> samples;
+        samples.reserve(iterations);
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            auto size = FileSize(path);
+            auto start = BenchClock::now();
+            LOGF_INFO("end to end %zu", i);
+            while (FileSize(path) == size)
+            {
+            }
+            samples.push_back(ElapsedNanos(start, BenchClock::now()));
+        }
+        return Histogram(samples);
+    }
+
+    /**
+     * Messages per second with threads producers, both as seen by the producers and until the file is written
+     */
+    std::string MeasureThroughput(const std::string& path, std::size_t threads, std::size_t perThread)
+    {
+        auto start = BenchClock::now();
+        std::vector<std::thread> producers;
+        for (std::size_t t = 0; t < threads; ++t)
+        {
+            producers.emplace_back([perThread, t]() {
+                for (std::size_t i = 0; i < perThread; ++i)
+                {
+                    LOGF_INFO("throughput thread %zu message %zu value %f", t, i, 3.14);
+                }
+            });
+        }
+        for (auto& producer : producers)
+        {
+            producer.join();
+        }
+        auto produced = BenchClock::now();
+        WaitForWriter(path, "throughput " + std::to_string(threads) + " done");
+        auto written = BenchClock::now();
+
+        auto messages = static_cast<double>(threads * perThread);
+        std::ostringstream json;
+        json << "{\"threads\": " << threads << ", \"messages\": " << threads * perThread
+             << ", \"enqueue_msgs_per_sec\": "
+             << static_cast<std::uint64_t>(messages * 1e9 / static_cast<double>(ElapsedNanos(start, produced)))
+             << ", \"written_msgs_per_sec\": "
+             << static_cast<std::uint64_t>(messages * 1e9 / static_cast<double>(ElapsedNanos(start, written)))
+             << "}";
+        return json.str();
+    }
+
+    void LatencyMacroTrace()
+    {
+        LOG_FUNCTION_TRACE;
+    }
+
+    bool ParseOptions(int argc, char* argv[], Options& options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            if (arg == "--iterations")
+            {
+                options.iterations = std::strtoull(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--threads")
+            {
+                options.threads = std::strtoull(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--log-file")
+            {
+                options.logFile = argv[++i];
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return options.iterations > 0;
+    }
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        std::cerr << "Usage: singlelog-bench [--iterations N] [--threads N] [--log-file path]\n";
+        return 2;
+    }
+    if (options.threads == 0)
+    {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    auto& logger = SingleLog::GetInstance();
+    logger.SetConsoleLogLevel(LogLevel::L_OFF);
+    logger.SetFileLogLevel(LogLevel::L_TRACE);
+    logger.SetLogFilePath(options.logFile);
+
+    std::ostringstream json;
+    json << "{\n  \"iterations\": " << options.iterations << ",\n";
+
+    {
+        std::vector<std::int64_t> samples;
+        samples.reserve(options.iterations);
+        for (std::size_t i = 0; i < options.iterations; ++i)
+        {
+            auto start = BenchClock::now();
+            auto end = BenchClock::now();
+            samples.push_back(ElapsedNanos(start, end));
+        }
+        json << "  \"clock_overhead\": " << Histogram(samples) << ",\n";
+    }
+
+    const std::string text = "a message of typical length for a log line";
+    const std::wstring wideModule = L"bench";
+    const std::wstring wideText = L"a wide message of typical length for a log line";
+    json << "  \"latency\": {\n";
+    json << "    \"LOG_INFO\": " << MeasureLatency(options.iterations, [&text](std::size_t) { LOG_INFO(text); })
+         << ",\n";
+    WaitForWriter(options.logFile, "LOG_INFO done");
+    json << "    \"LOGF_INFO\": " << MeasureLatency(options.iterations, [](std::size_t i) {
+        LOGF_INFO("formatted %zu of %s at %f", i, "bench", 2.5);
+    }) << ",\n";
+    WaitForWriter(options.logFile, "LOGF_INFO done");
+#if SINGLELOG_HAS_STD_FORMAT
+    json << "    \"LOGFMT_INFO\": " << MeasureLatency(options.iterations, [](std::size_t i) {
+        LOGFMT_INFO("formatted {} of {} at {}", i, "bench", 2.5);
+    }) << ",\n";
+    WaitForWriter(options.logFile, "LOGFMT_INFO done");
+#endif
+    json << "    \"Info_wide\": " << MeasureLatency(options.iterations, [&logger, &wideModule, &wideText](std::size_t) {
+        logger.Info(wideModule, wideText);
+    }) << ",\n";
+    WaitForWriter(options.logFile, "Info_wide done");
+    json << "    \"LOG_FUNCTION_TRACE\": "
+         << MeasureLatency(options.iterations, [](std::size_t) { LatencyMacroTrace(); }) << ",\n";
+    WaitForWriter(options.logFile, "LOG_FUNCTION_TRACE done");
+    const std::string traceFile = options.logFile + ".trace.json";
+    logger.SetTraceFilePath(traceFile);
+    json << "    \"LOG_FUNCTION_TRACE_traced\": "
+         << MeasureLatency(options.iterations, [](std::size_t) { LatencyMacroTrace(); }) << "\n";
+    logger.SetTraceFilePath("");
+    std::remove(traceFile.c_str());
+    json << "  },\n";
+
+    json << "  \"end_to_end\": " << MeasureEndToEnd(options.logFile, std::min<std::size_t>(options.iterations, 10000))
+         << ",\n";
+
+    json << "  \"throughput\": [\n";
+    for (std::size_t threads = 1; threads <= options.threads; threads *= 2)
+    {
+        json << "    " << MeasureThroughput(options.logFile, threads, options.iterations / threads)
+             << (threads * 2 <= options.threads ? ",\n" : "\n");
+    }
+    json << "  ],\n";
+
+    logger.SetFileLogLevel(LogLevel::L_ERROR);
+    json << "  \"disabled_ns_per_call\": {\n";
+    json << "    \"LOG_DEBUG\": " << MeasureDisabled(options.iterations, [&text](std::size_t) { LOG_DEBUG(text); })
+         << ",\n";
+    json << "    \"LOGF_DEBUG\": " << MeasureDisabled(options.iterations, [](std::size_t i) {
+        LOGF_DEBUG("formatted %zu of %s", i, "bench");
+    }) << ",\n";
+    json << "    \"Debug_wide\": "
+         << MeasureDisabled(options.iterations,
+                            [&logger, &wideModule, &wideText](std::size_t) { logger.Debug(wideModule, wideText); })
+         << ",\n";
+    json << "    \"LOG_FUNCTION_TRACE\": "
+         << MeasureDisabled(options.iterations, [](std::size_t) { LatencyMacroTrace(); }) << "\n";
+    json << "  }\n}\n";
+
+    std::cout << json.str();
+    std::remove(options.logFile.c_str());
+    return 0;
+}
@@ -9,22 +9,51 @@ import platform
 import sys
 import subprocess
 
+# Build targets: name -> (source directory, executable name, build with AddressSanitizer)
+# The benchmarks are built without the sanitizer so they measure the logger rather than its instrumentation.
+# The tests are run once built, and decode binary logs with singlelog-decode, which is built along with them.
+TARGETS = {
+    "example": (".", "SingleLogExample", True),
+    "singlelog-decode": ("tools", "singlelog-decode", True),
+    "bench": ("bench", "singlelog-bench", False),
+    "tests": ("tests", "singlelog-tests", True),
+}
 
-def build_project(build_type):
+
+def has_io_uring(compiler):
+    """
+    Checks whether the compiler can see <linux/io_uring.h>, which the FileSinkMode::IoUring backend needs.
+
+    Args:
+      compiler: The compiler command to probe.
+    """
+    if platform.system() != "Linux":
+        return False
+    probe = subprocess.run(
+        [compiler, "-x", "c++", "-fsyntax-only", "-"],
+        input="#include <linux/io_uring.h>\nint main() { return IORING_OP_WRITE; }\n",
+        text=True,
+        capture_output=True,
+    )
+    return probe.returncode == 0
+
+
+def build_project(build_type, target="example"):
     """
     Builds the CPP project with the specified build type (release or debug).
 
     Args:
       build_type: String representing the build type ("release" or "debug").
+      target: Name of the target in TARGETS to build.
     """
     # Source and header directories
-    src_dir = "."
+    src_dir, executable, sanitize = TARGETS[target]
     include_dir = "."
 
     # Define build directories based on OS and build type
     output_dir = "build"
     build_dir = os.path.join(output_dir, build_type)
-    obj_dir = os.path.join(build_dir, "obj")
+    obj_dir = os.path.join(build_dir, "obj", target)
     compiler = "g++"
     flags = []
     std_flag = "-std=c++20"
@@ -49,15 +78,16 @@ def build_project(build_type):
         "-Winit-self",
         "-Wredundant-decls",
         "-Wlogical-op",
-        "-Winline",
         "-Wunreachable-code",
         "-Wmissing-declarations",
         "-Wno-unused",
         "-Wfatal-errors",
         "-fdiagnostics-show-option",
-        "-fsanitize=address",
     ]
-    linker_flags = ["-fsanitize=address"]
+    linker_flags = []
+    if sanitize:
+        additional_flags.append("-fsanitize=address")
+        linker_flags.append("-fsanitize=address")
 
     if platform.system() == "Windows":
         compiler = "cl"
@@ -76,6 +106,10 @@ def build_project(build_type):
         else:
             flags = ["-g", "-O0", "-Wall", "-pedantic", std_flag] + additional_flags
 
+    # Build the io_uring file backend where the kernel headers have it
+    if has_io_uring(compiler):
+        flags.append("-DSINGLELOG_IO_URING=1")
+
     # Create build directory if it doesn't exist
     os.makedirs(output_dir, exist_ok=True)
     os.makedirs(build_dir, exist_ok=True)
@@ -105,7 +139,7 @@ def build_project(build_type):
         object_files.append(object_file)
 
     # Link object files into the final executable
-    output_file = os.path.join(build_dir, "SingleLogExample")
+    output_file = os.path.join(build_dir, executable)
     link_command = (
         [compiler] + linker_flags + object_files + [f"-L{obj_dir}", "-o", output_file]
     )
@@ -115,8 +149,22 @@ def build_project(build_type):
     print(f"Build completed successfully! Output: {output_file}")
 
 
+def run_tests(build_type):
+    """
+    Runs the tests from their build directory, where they write their log files. Exits if any check fails.
+
+    Args:
+      build_type: String representing the build type ("release" or "debug").
+    """
+    build_dir = os.path.join("build", build_type)
+    tests = os.path.join(".", TARGETS["tests"][1])
+    decoder = os.path.join(".", TARGETS["singlelog-decode"][1])
+    print(f"Running: {tests}")
+    subprocess.run([tests, decoder], cwd=build_dir, check=True)
+
+
 if __name__ == "__main__":
-    # Get build type from command line argument (optional)
+    # Get build type and target from command line arguments (optional)
     build_type = "release"
     if len(sys.argv) > 1:
         build_type = sys.argv[1].lower()
@@ -126,4 +174,19 @@ if __name__ == "__main__":
         )
         sys.exit(1)
 
-    build_project(build_type)
+    target = "example"
+    if len(sys.argv) > 2:
+        target = sys.argv[2].lower()
+    if target != "all" and target not in TARGETS:
+        print(
+            f"Invalid target '{target}'. Valid options are {', '.join(TARGETS)} or 'all'."
+        )
+        sys.exit(1)
+
+    names = list(TARGETS) if target == "all" else [target]
+    if "tests" in names and "singlelog-decode" not in names:
+        names.insert(0, "singlelog-decode")
+    for name in names:
+        build_project(build_type, name)
+    if "tests" in names:
+        run_tests(build_type)
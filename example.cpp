@@ -13,6 +13,7 @@ void SetupLogging();
 void LocalRefLogging();
 void MacroLogging();
 void MacroLogging_v2();
+void MacroLogging_v3();
 
 // Configure the logger
 void SetupLogging()
@@ -64,12 +65,27 @@ void MacroLogging_v2()
     LOGF_TRACE("%s message %d", "Trace", 7);
 }
 
+// Logging with std::format, where the standard library provides it
+void MacroLogging_v3()
+{
+#if SINGLELOG_HAS_STD_FORMAT
+    LOGFMT_CRITICAL("{} message {}", "Critical", 1);
+    LOGFMT_ERROR("{} message {}", "Error", 2);
+    LOGFMT_WARNING("{} message {:.1f}", "Warning", 3.0);
+    LOGFMT_NOTICE("{} message {:>3}", "Notice", 4);
+    LOGFMT_INFO("{} message {:#x}", "Info", 5);
+    LOGFMT_DEBUG("{} message {}", std::string("Debug"), 6);
+    LOGFMT_TRACE("Trace message {{7}}");
+#endif
+}
+
 int main()
 {
     SetupLogging();
     std::jthread t1(LocalRefLogging);
     std::jthread t2(MacroLogging);
     std::jthread t3(MacroLogging_v2);
+    std::jthread t4(MacroLogging_v3);
     Uplinkzero::Foo foo{};
     Uplinkzero::Bar bar{};
     return 0;
@@ -0,0 +1,326 @@
+// Copyright(c) 2016-2026, James Chapman
+//
+// Use of this source code is governed by a BSD -
+// style license that can be found in the LICENSE file or
+// at https://choosealicense.com/licenses/bsd-3-clause/
+
+// Checks binary logs decode back to the text format, key-value encoding, the overflow policies and Flush().
+// Log files are written to the working directory. Returns non-zero if any check fails.
+//
+// Usage: singlelog-tests <path to singlelog-decode>
+
+#include "SingleLog.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using namespace Uplinkzero::Logging;
+
+    int failures = 0;
+
+    void Check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED: " << what << "\n";
+            ++failures;
+        }
+    }
+
+    std::vector<std::string> ReadLines(const std::string& path)
+    {
+        std::vector<std::string> lines;
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    bool EndsWith(const std::string& text, const std::string& suffix)
+    {
+        return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    /**
+     * A text log line from its level onwards, leaving out the timestamp
+     */
+    std::string WithoutTime(const std::string& line)
+    {
+        auto level = line.find("  <");
+        return level == std::string::npos ? line : line.substr(level);
+    }
+
+    /**
+     * A logger of its own for each test, writing only to path, which is emptied first
+     */
+    SingleLog& TestLogger(const std::string& name, const std::string& path, const OutputFormat& format)
+    {
+        auto& logger = SingleLog::GetInstance(name);
+        logger.SetConsoleLogLevel(LogLevel::L_OFF);
+        logger.SetFileLogLevel(LogLevel::L_TRACE);
+        logger.SetFileOutputFormat(format);
+        std::remove(path.c_str());
+        logger.SetLogFilePath(path);
+        return logger;
+    }
+
+    /**
+     * Holds every Write() back until Open(), so messages pile up in the sink's queue
+     */
+    class GatedSink final : public LogSink
+    {
+    public:
+        void Write(const std::string& lines) override
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_writing = true;
+            m_changed.notify_all();
+            m_changed.wait(lock, [this] { return m_open; });
+            m_text += lines;
+        }
+
+        /**
+         * Wait until the writer is held in Write(), after which nothing leaves the queue until Open()
+         */
+        void WaitUntilWriting()
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_changed.wait(lock, [this] { return m_writing; });
+        }
+
+        void Open()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_open = true;
+            }
+            m_changed.notify_all();
+        }
+
+        std::string Text()
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            return m_text;
+        }
+
+    private:
+        std::mutex m_lock{};
+        std::condition_variable m_changed{};
+        bool m_writing{false};
+        bool m_open{false};
+        std::string m_text{};
+    };
+
+    void LogSamples(SingleLog& logger)
+    {
+        std::string owned = "owned";
+        LOG_TO(logger, INFO, "plain message");
+        LOGF_TO(logger, WARNING, "int %d unsigned %u long long %lld", -7, 7u, 1LL << 40);
+        LOGF_TO(logger, ERROR, "double %.3f float %g string %s char %c", 2.5, 0.25f, "text", 'x');
+        LOGF_TO(logger, INFO, "std::string %s width [%*d] pointer %p", owned, 5, 42, static_cast<void*>(nullptr));
+        LOG_KV_TO(logger, NOTICE, "request done", "user", "bob", "latency_us", 125, "ratio", 0.1 + 0.2);
+        // Not convertible in the C locale, both sides write the format with a marker
+        LOGF_TO(logger, DEBUG, "wide %ls end", L"\u00e9");
+    }
+
+    void TestBinaryRoundTrip(const std::string& decoder)
+    {
+        auto& text = TestLogger("round-trip-text", "tests-round-trip.log", OutputFormat::Text);
+        auto& binary = TestLogger("round-trip-binary", "tests-round-trip.slog", OutputFormat::Binary);
+        LogSamples(text);
+        LogSamples(binary);
+        text.Flush();
+        binary.Flush();
+
+        auto command = decoder + " tests-round-trip.slog > tests-round-trip-decoded.log";
+        Check(std::system(command.c_str()) == 0, "singlelog-decode runs");
+        auto expected = ReadLines("tests-round-trip.log");
+        auto decoded = ReadLines("tests-round-trip-decoded.log");
+        Check(expected.size() == 6, "text log has every sample");
+        Check(decoded.size() == expected.size(), "decoded log has every sample");
+        for (std::size_t i = 0; i < expected.size() && i < decoded.size(); ++i)
+        {
+            Check(WithoutTime(decoded[i]) == WithoutTime(expected[i]),
+                  "decoded '" + decoded[i] + "' matches '" + expected[i] + "'");
+        }
+        Check(expected.size() == 6 && EndsWith(expected[5], "wide %ls end [format error]"),
+              "unconvertible wide string is marked");
+    }
+
+    void LogFields(SingleLog& logger)
+    {
+        LOG_KV_TO(logger, INFO, "request done", "user", "bob", "latency_us", 125, "ratio", 0.1 + 0.2, "ok", true,
+                  "quoted", "a \"b\"");
+    }
+
+    void TestKeyValue()
+    {
+        struct Case
+        {
+            OutputFormat format;
+            const char* expected;
+        };
+        const Case cases[] = {
+            {OutputFormat::Text, "  <INFO>  LogFields:  request done user=bob latency_us=125 "
+                                 "ratio=0.30000000000000004 ok=true quoted=\"a \\\"b\\\"\""},
+            {OutputFormat::Json, "\"module\":\"LogFields\",\"message\":\"request done\",\"user\":\"bob\","
+                                 "\"latency_us\":125,\"ratio\":0.30000000000000004,\"ok\":true,"
+                                 "\"quoted\":\"a \\\"b\\\"\"}"},
+            {OutputFormat::Logfmt, " module=LogFields msg=\"request done\" user=bob latency_us=125 "
+                                   "ratio=0.30000000000000004 ok=true quoted=\"a \\\"b\\\"\""},
+        };
+        for (const auto& test : cases)
+        {
+            auto path = "tests-kv-" + std::to_string(static_cast<int>(test.format)) + ".log";
+            auto& logger = TestLogger("kv", path, test.format);
+            LogFields(logger);
+            logger.Flush();
+            auto lines = ReadLines(path);
+            Check(lines.size() == 1 && EndsWith(lines[0], test.expected),
+                  path + " holds '" + (lines.empty() ? "" : lines[0]) + "', expected it to end in '" +
+                      test.expected + "'");
+        }
+    }
+
+    void TestOverflowPolicies()
+    {
+        const OverflowPolicy policies[] = {OverflowPolicy::DropNewest, OverflowPolicy::DropOldest,
+                                           OverflowPolicy::Block};
+        for (auto policy : policies)
+        {
+            auto name = "overflow-" + std::to_string(static_cast<int>(policy));
+            auto& logger = TestLogger(name, "tests-" + name + ".log", OutputFormat::Text);
+            logger.SetFileLogLevel(LogLevel::L_OFF);
+            auto sink = std::make_shared<GatedSink>();
+            logger.AddSink(sink, LogLevel::L_INFO);
+            logger.SetSinkQueueCapacity(sink, 4);
+            logger.SetSinkOverflowPolicy(sink, policy);
+
+            // Hold the writer in the sink's Write() so the queue fills up behind it
+            LOGF_TO(logger, INFO, "message %d.", 0);
+            sink->WaitUntilWriting();
+            // A blocked logging thread only moves on once the sink lets the writer drain the queue
+            std::thread opener([&sink, policy] {
+                if (policy == OverflowPolicy::Block)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                    sink->Open();
+                }
+            });
+            for (int i = 1; i < 100; ++i)
+            {
+                LOGF_TO(logger, INFO, "message %d.", i);
+            }
+            opener.join();
+            sink->Open();
+            logger.Flush();
+
+            auto text = sink->Text();
+            auto stats = logger.GetStats().sinks.at(0);
+            bool first = text.find("message 0.") != std::string::npos;
+            bool last = text.find("message 99.") != std::string::npos;
+            Check(stats.written + stats.dropped == 100, name + " accounts for every message");
+            switch (policy)
+            {
+            case OverflowPolicy::DropNewest:
+                Check(stats.dropped > 0 && first && !last, name + " drops the newest messages");
+                break;
+            case OverflowPolicy::DropOldest:
+                Check(stats.dropped > 0 && last, name + " drops the oldest messages");
+                break;
+            case OverflowPolicy::Block:
+                Check(stats.dropped == 0 && first && last, name + " keeps every message");
+                break;
+            case OverflowPolicy::DropBelowLevel:
+            default:
+                break;
+            }
+        }
+    }
+
+    void TestFlush()
+    {
+        auto& logger = TestLogger("flush", "tests-flush.log", OutputFormat::Text);
+        // Nothing would be written before the process exits without an explicit flush
+        logger.SetWriteBatchSize(std::size_t{1} << 30);
+        logger.SetMaxFlushLatency(std::chrono::hours(1));
+
+        for (int i = 0; i < 1000; ++i)
+        {
+            LOGF_TO(logger, INFO, "message %d", i);
+        }
+        logger.Flush();
+        Check(ReadLines("tests-flush.log").size() == 1000, "Flush() writes everything logged before it");
+
+        for (int i = 0; i < 500; ++i)
+        {
+            LOGF_TO(logger, INFO, "message %d", i);
+        }
+        logger.FlushAsync().wait();
+        Check(ReadLines("tests-flush.log").size() == 1500, "FlushAsync() completes once everything is written");
+
+        LOG_TO(logger, INFO, "last");
+        Check(logger.Flush(std::chrono::seconds(10)), "Flush(timeout) reports success");
+        Check(ReadLines("tests-flush.log").size() == 1501, "Flush(timeout) writes everything logged before it");
+    }
+
+#if SINGLELOG_HAS_STD_FORMAT
+    void LogStdFormat(SingleLog& logger)
+    {
+        LOGFMT_TO(logger, INFO, "{} took {:.1f} ms", "request", 2.25);
+        LOGFMT_TO(logger, INFO, "no arguments {{escaped}}");
+    }
+
+    void TestStdFormat()
+    {
+        auto& logger = TestLogger("std-format", "tests-std-format.log", OutputFormat::Text);
+        LogStdFormat(logger);
+        logger.Flush();
+        auto lines = ReadLines("tests-std-format.log");
+        Check(lines.size() == 2 && EndsWith(lines[0], "LogStdFormat:  request took 2.2 ms") &&
+                  EndsWith(lines[1], "LogStdFormat:  no arguments {escaped}"),
+              "LOGFMT_* formats with and without arguments");
+    }
+#endif
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: singlelog-tests <path to singlelog-decode>\n";
+        return 2;
+    }
+
+    TestBinaryRoundTrip(argv[1]);
+    TestKeyValue();
+    TestOverflowPolicies();
+    TestFlush();
+#if SINGLELOG_HAS_STD_FORMAT
+    TestStdFormat();
+#else
+    std::cout << "LOGFMT_* checks skipped, the standard library has no std::format\n";
+#endif
+
+    if (failures != 0)
+    {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "All checks passed\n";
+    return 0;
+}
@@ -0,0 +1,646 @@
+// Copyright(c) 2016-2026, James Chapman
+//
+// Use of this source code is governed by a BSD -
+// style license that can be found in the LICENSE file or
+// at https://choosealicense.com/licenses/bsd-3-clause/
+
+// Turns binary SingleLog files (OutputFormat::Binary) back into the text log format or JSON lines.
+//
+// Usage: singlelog-decode [--json] [--precision s|ms|us|ns] <file>
+
+#include "SingleLog.hpp"
+
+#include <cstdlib>
+#include <cwchar>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using namespace Uplinkzero::Logging;
+
+    struct CallSite
+    {
+        std::string module{};
+        std::string format{};
+        std::string argTypes{};
+    };
+
+    using Argument = FieldValue;
+
+    /**
+     * Sequential reads from the file contents, every read fails once the data runs out
+     */
+    class Reader
+    {
+    public:
+        explicit Reader(const std::string& data) : m_data(data)
+        {
+        }
+
+        template <typename T>
+        bool Get(T& value)
+        {
+            if (m_data.size() - m_pos < sizeof(T))
+            {
+                return false;
+            }
+            std::memcpy(&value, m_data.data() + m_pos, sizeof(T));
+            m_pos += sizeof(T);
+            return true;
+        }
+
+        bool GetBytes(std::string& value, std::size_t length)
+        {
+            if (m_data.size() - m_pos < length)
+            {
+                return false;
+            }
+            value.assign(m_data, m_pos, length);
+            m_pos += length;
+            return true;
+        }
+
+        bool GetString(std::string& value)
+        {
+            std::uint16_t length = 0;
+            return Get(length) && GetBytes(value, length);
+        }
+
+        bool AtMagic() const
+        {
+            return m_data.compare(m_pos, sizeof(BinaryFormat::Magic),
+                                  std::string(BinaryFormat::Magic, sizeof(BinaryFormat::Magic))) == 0;
+        }
+
+        bool AtEnd() const
+        {
+            return m_pos >= m_data.size();
+        }
+
+    private:
+        const std::string& m_data;
+        std::size_t m_pos{0};
+    };
+
+    template <typename T>
+    bool ReadValue(const char* args, std::size_t size, std::size_t& offset, T& value)
+    {
+        if (size - offset < sizeof(T))
+        {
+            return false;
+        }
+        std::memcpy(&value, args + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+
+    /**
+     * Strings are stored as a size_t byte count then the characters, padded to the character alignment.
+     * A null string has no characters, and a string passed for %p keeps its address instead.
+     */
+    template <typename CharT>
+    bool ReadString(const char* args, std::size_t size, std::size_t& offset, const CharT*& value,
+                    const void*& address)
+    {
+        using StringArg = Uplinkzero::Logging::DeferredStringArg<CharT>;
+        std::size_t bytes = 0;
+        if (!ReadValue(args, size, offset, bytes))
+        {
+            return false;
+        }
+        if (bytes == StringArg::NullString)
+        {
+            value = StringArg::NullText();
+            return true;
+        }
+        if (bytes == StringArg::Address)
+        {
+            return ReadValue(args, size, offset, address);
+        }
+        offset += (alignof(CharT) - offset % alignof(CharT)) % alignof(CharT);
+        if (size < offset || size - offset < bytes)
+        {
+            return false;
+        }
+        value = reinterpret_cast<const CharT*>(args + offset);
+        offset += bytes;
+        return true;
+    }
+
+    /**
+     * Decode the argument bytes of a record using the type codes of its call site.
+     * args must be aligned like LogRecord::args so wide strings can be read in place.
+     */
+    bool DecodeArguments(const std::string& argTypes, const char* args, std::size_t size,
+                         std::vector<Argument>& arguments)
+    {
+        std::size_t offset = 0;
+        for (char type : argTypes)
+        {
+            Argument argument{};
+            argument.type = type;
+            bool ok = true;
+            switch (type)
+            {
+            case '?':
+            case 'B': {
+                std::uint8_t value = 0;
+                ok = ReadValue(args, size, offset, value);
+                argument.unsignedValue = value;
+                break;
+            }
+            case 'b': {
+                std::int8_t value = 0;
+                ok = ReadValue(args, size, offset, value);
+                argument.signedValue = value;
+                break;
+            }
+            case 'h': {
+                std::int16_t value = 0;
+                ok = ReadValue(args, size, offset, value);
+                argument.signedValue = value;
+                break;
+            }
+            case 'H': {
+                std::uint16_t value = 0;
+                ok = ReadValue(args, size, offset, value);
+                argument.unsignedValue = value;
+                break;
+            }
+            case 'i': {
+                std::int32_t value = 0;
+                ok = ReadValue(args, size, offset, value);
+                argument.signedValue = value;
+                break;
+            }
+            case 'I': {
+                std::uint32_t value = 0;
+                ok = ReadValue(args, size, offset, value);
+                argument.unsignedValue = value;
+                break;
+            }
+            case 'l': {
+                std::int64_t value = 0;
+                ok = ReadValue(args, size, offset, value);
+                argument.signedValue = value;
+                break;
+            }
+            case 'L': {
+                std::uint64_t value = 0;
+                ok = ReadValue(args, size, offset, value);
+                argument.unsignedValue = value;
+                break;
+            }
+            case 'f': {
+                float value = 0;
+                ok = ReadValue(args, size, offset, value);
+                argument.floatValue = value;
+                break;
+            }
+            case 'd': {
+                double value = 0;
+                ok = ReadValue(args, size, offset, value);
+                argument.floatValue = value;
+                break;
+            }
+            case 'D':
+                ok = ReadValue(args, size, offset, argument.floatValue);
+                break;
+            case 'p':
+                ok = ReadValue(args, size, offset, argument.pointerValue);
+                break;
+            case 's':
+                ok = ReadString(args, size, offset, argument.stringValue, argument.pointerValue);
+                break;
+            case 'w':
+                ok = ReadString(args, size, offset, argument.wideValue, argument.pointerValue);
+                break;
+            default:
+                // Not a printf type, its size is unknown so nothing after it can be decoded either
+                ok = false;
+                break;
+            }
+            if (!ok)
+            {
+                return false;
+            }
+            // Keep signed and unsigned views in step so either kind of conversion prints the original bits
+            if (type == 'b' || type == 'h' || type == 'i' || type == 'l')
+            {
+                argument.unsignedValue = static_cast<std::uint64_t>(argument.signedValue);
+            }
+            else
+            {
+                argument.signedValue = static_cast<std::int64_t>(argument.unsignedValue);
+            }
+            arguments.push_back(argument);
+        }
+        return true;
+    }
+
+    /**
+     * Returns false if snprintf fails, e.g. on a wide string the locale cannot convert
+     */
+    template <typename T>
+    bool AppendPrintf(std::string& out, const std::string& spec, T value)
+    {
+        char buffer[256];
+        auto length = std::snprintf(buffer, sizeof(buffer), spec.c_str(), value);
+        if (length < 0)
+        {
+            return false;
+        }
+        if (static_cast<std::size_t>(length) < sizeof(buffer))
+        {
+            out.append(buffer, static_cast<std::size_t>(length));
+            return true;
+        }
+        std::vector<char> large(static_cast<std::size_t>(length) + 1);
+        std::snprintf(large.data(), large.size(), spec.c_str(), value);
+        out.append(large.data(), static_cast<std::size_t>(length));
+        return true;
+    }
+
+    /**
+     * Format one conversion specification with an argument whose type is only known at run time.
+     * The argument is passed to snprintf as the type its length modifier asks for, as in the original call.
+     * Returns false if snprintf fails.
+     */
+    bool AppendConversion(std::string& out, const std::string& spec, const std::string& length, char conversion,
+                          const Argument& argument)
+    {
+        switch (conversion)
+        {
+        case 'd':
+        case 'i':
+            if (length == "l")
+            {
+                return AppendPrintf(out, spec, static_cast<long>(argument.signedValue));
+            }
+            else if (length == "ll" || length == "j" || length == "z" || length == "t")
+            {
+                return AppendPrintf(out, spec, static_cast<long long>(argument.signedValue));
+            }
+            else
+            {
+                return AppendPrintf(out, spec, static_cast<int>(argument.signedValue));
+            }
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            if (length == "l")
+            {
+                return AppendPrintf(out, spec, static_cast<unsigned long>(argument.unsignedValue));
+            }
+            else if (length == "ll" || length == "j" || length == "z" || length == "t")
+            {
+                return AppendPrintf(out, spec, static_cast<unsigned long long>(argument.unsignedValue));
+            }
+            else
+            {
+                return AppendPrintf(out, spec, static_cast<unsigned int>(argument.unsignedValue));
+            }
+        case 'c':
+            return AppendPrintf(out, spec, static_cast<int>(argument.signedValue));
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (length == "L")
+            {
+                return AppendPrintf(out, spec, argument.floatValue);
+            }
+            else
+            {
+                return AppendPrintf(out, spec, static_cast<double>(argument.floatValue));
+            }
+        case 's':
+            if (argument.wideValue != nullptr)
+            {
+                return AppendPrintf(out, spec, argument.wideValue);
+            }
+            else
+            {
+                return AppendPrintf(out, spec, argument.stringValue != nullptr ? argument.stringValue : "(null)");
+            }
+        case 'p':
+            return AppendPrintf(out, spec, argument.pointerValue);
+        default:
+            out += spec;
+            return true;
+        }
+    }
+
+    /**
+     * printf with decoded arguments: each conversion specification is run through snprintf on its own
+     */
+    std::string FormatMessage(const std::string& format, const std::vector<Argument>& arguments)
+    {
+        std::string out;
+        std::size_t next = 0;
+        std::size_t pos = 0;
+        while (pos < format.size())
+        {
+            if (format[pos] != '%')
+            {
+                out += format[pos++];
+                continue;
+            }
+            if (pos + 1 < format.size() && format[pos + 1] == '%')
+            {
+                out += '%';
+                pos += 2;
+                continue;
+            }
+
+            std::string spec = "%";
+            ++pos;
+            while (pos < format.size() && std::string("-+ #0'").find(format[pos]) != std::string::npos)
+            {
+                spec += format[pos++];
+            }
+            // Width and precision given as '*' take an int argument, substitute its value
+            for (int part = 0; part < 2; ++part)
+            {
+                if (part == 1)
+                {
+                    if (pos >= format.size() || format[pos] != '.')
+                    {
+                        break;
+                    }
+                    spec += format[pos++];
+                }
+                if (pos < format.size() && format[pos] == '*')
+                {
+                    ++pos;
+                    spec += next < arguments.size() ? std::to_string(arguments[next++].signedValue) : "0";
+                }
+                while (pos < format.size() && format[pos] >= '0' && format[pos] <= '9')
+                {
+                    spec += format[pos++];
+                }
+            }
+            std::string length;
+            while (pos < format.size() && std::string("hljztL").find(format[pos]) != std::string::npos)
+            {
+                length += format[pos++];
+            }
+            if (pos >= format.size())
+            {
+                out += spec + length;
+                break;
+            }
+            char conversion = format[pos++];
+            spec += length;
+            spec += conversion;
+            if (conversion == 'n')
+            {
+                continue;
+            }
+            if (next >= arguments.size())
+            {
+                out += spec;
+                continue;
+            }
+            if (!AppendConversion(out, spec, length, conversion, arguments[next++]))
+            {
+                // Written the way SingleLog writes a message snprintf fails on
+                return format + Uplinkzero::StringTools::FormatErrorMarker;
+            }
+        }
+        return out;
+    }
+
+    /**
+     * Read the file header, warning if the file came from a platform with different type sizes
+     */
+    bool ReadHeader(Reader& reader)
+    {
+        std::string magic;
+        std::uint32_t version = 0;
+        std::uint8_t wcharSize = 0;
+        std::uint8_t longSize = 0;
+        std::uint8_t pointerSize = 0;
+        if (!reader.GetBytes(magic, sizeof(BinaryFormat::Magic)) ||
+            magic != std::string(BinaryFormat::Magic, sizeof(BinaryFormat::Magic)) || !reader.Get(version) ||
+            !reader.Get(wcharSize) || !reader.Get(longSize) || !reader.Get(pointerSize))
+        {
+            std::cerr << "singlelog-decode: not a binary SingleLog file\n";
+            return false;
+        }
+        if (version == 0 || version > BinaryFormat::Version)
+        {
+            std::cerr << "singlelog-decode: unsupported format version " << version << "\n";
+            return false;
+        }
+        if (wcharSize != sizeof(wchar_t) || longSize != sizeof(long) || pointerSize != sizeof(void*))
+        {
+            std::cerr << "singlelog-decode: file was written on a platform with different type sizes, "
+                         "wide strings and pointers may not decode correctly\n";
+        }
+        return true;
+    }
+
+    int Usage()
+    {
+        std::cerr << "Usage: singlelog-decode [--json] [--precision s|ms|us|ns] <file>\n";
+        return 2;
+    }
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    bool json = false;
+    TimestampPrecision precision = TimestampPrecision::Seconds;
+    std::string path;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--json")
+        {
+            json = true;
+        }
+        else if (arg == "--precision" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "ms")
+            {
+                precision = TimestampPrecision::Milliseconds;
+            }
+            else if (value == "us")
+            {
+                precision = TimestampPrecision::Microseconds;
+            }
+            else if (value == "ns")
+            {
+                precision = TimestampPrecision::Nanoseconds;
+            }
+            else if (value != "s")
+            {
+                return Usage();
+            }
+        }
+        else if (path.empty() && !arg.empty() && arg[0] != '-')
+        {
+            path = arg;
+        }
+        else
+        {
+            return Usage();
+        }
+    }
+    if (path.empty())
+    {
+        return Usage();
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "singlelog-decode: cannot open " << path << "\n";
+        return 1;
+    }
+    std::string data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+
+    Reader reader(data);
+    if (!ReadHeader(reader))
+    {
+        return 1;
+    }
+
+    std::map<std::uint32_t, CallSite> callSites;
+    TimestampFormatter timestamps;
+    std::vector<Argument> arguments;
+    std::vector<std::max_align_t> aligned;
+    std::string scratch;
+    std::string out;
+    while (!reader.AtEnd())
+    {
+        if (reader.AtMagic())
+        {
+            if (!ReadHeader(reader))
+            {
+                return 1;
+            }
+            continue;
+        }
+        char type = 0;
+        reader.Get(type);
+        if (type == BinaryFormat::CallSite)
+        {
+            std::uint32_t id = 0;
+            CallSite site;
+            if (!reader.Get(id) || !reader.GetString(site.module) || !reader.GetString(site.format) ||
+                !reader.GetString(site.argTypes))
+            {
+                break;
+            }
+            callSites[id] = site;
+            continue;
+        }
+        if (type != BinaryFormat::Record)
+        {
+            std::cerr << "singlelog-decode: corrupt entry, stopping\n";
+            return 1;
+        }
+
+        std::int64_t nanos = 0;
+        std::uint16_t level = 0;
+        std::uint32_t threadId = 0;
+        std::uint32_t callSiteId = 0;
+        std::uint32_t size = 0;
+        std::string payload;
+        if (!reader.Get(nanos) || !reader.Get(level) || !reader.Get(threadId) || !reader.Get(callSiteId) ||
+            !reader.Get(size) || !reader.GetBytes(payload, size))
+        {
+            // A record cut short by a crash, everything before it has been decoded
+            break;
+        }
+
+        std::string module;
+        std::string message = payload;
+        std::string fields;
+        auto site = callSites.find(callSiteId);
+        if (callSiteId != 0 && site == callSites.end())
+        {
+            message = "<unknown call site " + std::to_string(callSiteId) + ">";
+        }
+        else if (site != callSites.end())
+        {
+            module = site->second.module;
+            if (!site->second.format.empty())
+            {
+                aligned.assign(payload.size() / sizeof(std::max_align_t) + 1, std::max_align_t{});
+                std::memcpy(aligned.data(), payload.data(), payload.size());
+                arguments.clear();
+                const auto& argTypes = site->second.argTypes;
+                bool keyValue = !argTypes.empty() && argTypes[0] == '=';
+                if (DecodeArguments(keyValue ? argTypes.substr(1) : argTypes,
+                                    reinterpret_cast<const char*>(aligned.data()), payload.size(), arguments))
+                {
+                    message = keyValue ? site->second.format : FormatMessage(site->second.format, arguments);
+                    for (std::size_t i = 0; keyValue && i + 1 < arguments.size(); i += 2)
+                    {
+                        AppendField(json ? fields : message, arguments[i].stringValue, arguments[i + 1],
+                                    json ? OutputFormat::Json : OutputFormat::Text, scratch);
+                    }
+                }
+                else
+                {
+                    message = site->second.format + " <undecodable arguments>";
+                }
+            }
+        }
+
+        out.clear();
+        auto levelName = LevelName(static_cast<LogLevel>(level));
+        if (json)
+        {
+            std::string time;
+            timestamps.AppendWallTime(nanos, precision, time);
+            if (callSiteId == 0 && !message.empty() && message.back() == '\n')
+            {
+                message.pop_back();
+            }
+            out += "{\"time\":";
+            AppendJsonString(out, time.data(), time.size());
+            out += ",\"level\":\"";
+            out += levelName;
+            out += "\",\"thread\":";
+            out += std::to_string(threadId);
+            out += ",\"module\":";
+            AppendJsonString(out, module.data(), module.size());
+            out += ",\"message\":";
+            AppendJsonString(out, message.data(), message.size());
+            out += fields;
+            out += "}\n";
+        }
+        else if (callSiteId == 0)
+        {
+            out += message;
+        }
+        else
+        {
+            timestamps.AppendWallTime(nanos, precision, out);
+            out += "  <";
+            out += levelName;
+            out += ">  ";
+            out += module;
+            out += ":  ";
+            out += message;
+            out += "\n";
+        }
+        std::cout << out;
+    }
+    return 0;
+}